@@ -1,5 +1,31 @@
 /* MQ2DanNet -- peer to peer auto-discovery networking plugin
  *
+ * dannuic: version 0.7538 -- peers announce a wire protocol version when they enter, and peers on a different one are ignored (0.7526 changed command ids, so nothing older can talk to this, and anything older than this is ignored)
+ * dannuic: version 0.7537 -- observed data is stored in a flat table keyed by peer and query, and the TLO reads it in place
+ * dannuic: version 0.7536 -- TLO lists are built once per directory/observer change instead of on every access
+ * dannuic: version 0.7535 -- peer names, group names and observed queries are interned once, and the directory and observer maps key on the ids
+ * dannuic: version 0.7534 -- peer groups are indexed both ways and kept up to date as peers come and go, so looking up a peer's groups or dropping a peer doesn't walk every group
+ * dannuic: version 0.7533 -- the peer/group directory is published by the actor as an immutable snapshot, so reading it never locks or copies
+ * dannuic: version 0.7532 -- queries are canonicalized once and interned instead of going through a regex on every use
+ * dannuic: version 0.7531 -- queries and observers asking for the same thing in a pulse share a single evaluation
+ * dannuic: version 0.7530 -- /dquery can answer from a cache of recent results with a max age (/dquery -m, /dnet maxage)
+ * dannuic: version 0.7529 -- /dgquery asks a whole group the same query with one shout and gathers every answer
+ * dannuic: version 0.7528 -- /dquery takes several peers and queries at once, every request gets a handle and its own result
+ * dannuic: version 0.7527 -- responses are tracked in a pending table with generation tagged ids and expire if the peer never answers
+ * dannuic: version 0.7526 -- commands go over the wire as a 4 byte id hashed from their name at compile time and dispatch through a flat table
+ * dannuic: version 0.7525 -- commands are carried around as a single Message that owns its body, whether it came off the wire or was packed locally
+ * dannuic: version 0.7524 -- incoming commands are decoded straight out of the received frame with a bounds-checked reader instead of a stringstream
+ * dannuic: version 0.7523 -- outgoing commands are serialized into a single growable buffer that is handed to zmq without copying
+ * dannuic: version 0.7522 -- int, int64, float, bool and spawn results go over the wire typed and are only turned into strings when read
+ * dannuic: version 0.7521 -- observers keep their own subscriber registry instead of a zyre group per query (/dobserve -drop sends Forget)
+ * dannuic: version 0.7520 -- observer values that changed in a pulse are whispered to each subscriber as a single UpdateBatch
+ * dannuic: version 0.7519 -- observer cadence adapts to eval cost, change rate, subscriber count and a per-frame budget (/dnet observebudget)
+ * dannuic: version 0.7518 -- observers are published off a min-heap of jittered due times instead of checking every observer every pulse
+ * dannuic: version 0.7517 -- observer updates go into a mailbox keyed by sender and group, so only the newest value for each observer is dispatched
+ * dannuic: version 0.7516 -- incoming whispers and shouts are queued straight from the actor's zyre handler, keeping zyre's frame
+ * dannuic: version 0.7515 -- incoming commands go through a lock-free FIFO ring instead of a mutex-guarded (and LIFO) deque
+ * dannuic: version 0.7514 -- commands are drained in batches under a per-pulse time budget (/dnet pulsebudget), with pulse stats on the TLO
+ * dannuic: version 0.7513 -- whisper routing resolves peer UUIDs from an actor-local index instead of walking zyre's peer list
  * dannuic: version 0.7512 -- added keepalive to main actor thread with configuration option for frequency, and added options for expire and evasive timeouts
  * dannuic: version 0.7511 -- fixed bug associated with high CPU usage (removed * default to interface) and made interface UI a little better
  * dannuic: version 0.7510 -- major reworking of observers to be way more efficient
@@ -48,19 +74,37 @@
 #include "..\archive\archive.h"
 #endif
 
-#include <regex>
+#include <chrono>
+#include <climits>
+#include <cmath>
 #include <iterator>
 #include <functional>
 #include <numeric>
 #include <sstream>
+#include <type_traits>
 #include <algorithm>
 #include <map>
+#include <memory>
 #include <queue>
+#include <random>
 #include <set>
 #include <string>
+#include <tuple>
+#include <utility>
+#include <unordered_map>
+#include <unordered_set>
+#include <deque>
 #include <mutex>
+#include <atomic>
 
-PLUGIN_VERSION(0.7512);
+#include "command_table.h"
+#include "mpsc_queue.h"
+#include "observation_table.h"
+#include "pending_table.h"
+#include "symbol_table.h"
+#include "wire.h"
+
+PLUGIN_VERSION(0.7538);
 PreSetup("MQ2DanNet");
 
 #pragma region NodeDefs
@@ -72,12 +116,24 @@ PreSetup("MQ2DanNet");
 #endif
 
 // reduce some boilerplate - we don't actually want to instantiate our commands, so delete all 5 assign/ctors
-#define COMMAND(_Name, ...)                                                         \
+// _Params is what pack takes after the recipient, and the rest is the schema: the fields that go on the wire, in order.
+// encode writes exactly those fields and unpack reads exactly those back, so a pack and its callback can't disagree
+#define COMMAND_PARAMS(...) const std::string& recipient, ##__VA_ARGS__
+#define COMMAND(_Name, _Params, ...)                                                \
     class _Name {                                                                   \
     public:                                                                         \
+        typedef std::tuple<__VA_ARGS__> Fields;                                     \
         static const std::string name() { return #_Name; }                          \
-        static const bool callback(std::stringstream&& args);                       \
-        static std::stringstream pack(const std::string& recipient, ##__VA_ARGS__); \
+        static constexpr uint32_t id() { return command_id(#_Name); }               \
+        static const bool callback(Node::Reader&& args);                            \
+        static Node::Buffer pack(COMMAND_PARAMS _Params);                           \
+        template <typename... Args>                                                 \
+        static Node::Buffer encode(const Args&... fields) {                         \
+            return encode_fields<Fields>(fields...);                                \
+        }                                                                           \
+        static Fields unpack(Node::Reader& args) {                                  \
+            return unpack_fields<Fields>(args);                                     \
+        }                                                                           \
                                                                                     \
     private:                                                                        \
         _Name() = delete;                                                           \
@@ -88,37 +144,53 @@ PreSetup("MQ2DanNet");
     }
 
 namespace MQ2DanNet {
+// FNV-1a, so a command's wire id is fixed by its name at compile time. Responses hash their generated name the same way
+constexpr uint32_t command_id(const char* name, uint32_t hash = 2166136261u) {
+    return *name ? command_id(name + 1, (hash ^ static_cast<unsigned char>(*name)) * 16777619u) : hash;
+}
+
+// bump this whenever something on the wire changes in a way an older plugin can't read. It goes out in our zyre headers,
+// and a peer that enters with a different one (or none, which is everything before the hashed command ids) is ignored
+constexpr unsigned int protocol_version = 2;
+
 class Node final {
 public:
     MQ2DANNET_NODE_API static Node& get();
 
+    typedef MQ2DanNet::symbol symbol;
+
     MQ2DANNET_NODE_API void join(const std::string& group);
     MQ2DANNET_NODE_API void leave(const std::string& group);
 
     MQ2DANNET_NODE_API void on_join(std::function<bool(const std::string&, const std::string&)> callback);
     MQ2DANNET_NODE_API void on_leave(std::function<bool(const std::string&, const std::string&)> callback);
 
+    typedef MQ2DanNet::Buffer Buffer;
+    typedef MQ2DanNet::View View;
+    typedef MQ2DanNet::Reader Reader;
+
     template <typename T, typename... Args>
     void whisper(const std::string& recipient, Args&&... args) {
-        std::stringstream arg_stream = pack<T>(recipient, std::forward<Args>(args)...);
-        respond(recipient, name<T>(), std::move(arg_stream));
+        respond(recipient, id<T>(), pack<T>(recipient, std::forward<Args>(args)...));
     }
 
     template <typename T, typename... Args>
     void shout(const std::string& group, Args&&... args) {
-        std::stringstream arg_stream = pack<T>(group, std::forward<Args>(args)...);
-        publish(group, name<T>(), std::move(arg_stream));
+        publish(group, id<T>(), pack<T>(group, std::forward<Args>(args)...));
     }
 
     MQ2DANNET_NODE_API const std::list<std::string> get_info();
-    MQ2DANNET_NODE_API const std::set<std::string> get_peers();
-    MQ2DANNET_NODE_API const std::set<std::string> get_all_groups();
-    MQ2DANNET_NODE_API const std::set<std::string> get_own_groups();
-    MQ2DANNET_NODE_API const std::map<std::string, std::set<std::string>> get_group_peers();
-    MQ2DANNET_NODE_API const std::set<std::string> get_group_peers(const std::string& group);
-    MQ2DANNET_NODE_API const std::set<std::string> get_peer_groups(const std::string& peer);
+    // these point into the current directory snapshot, so they're only good until the next pulse -- copy them to keep them
+    MQ2DANNET_NODE_API const std::set<std::string>& get_peers();
+    MQ2DANNET_NODE_API const std::set<std::string>& get_all_groups();
+    MQ2DANNET_NODE_API const std::set<std::string>& get_own_groups();
+    MQ2DANNET_NODE_API const std::map<std::string, std::set<std::string>>& get_group_peers();
+    MQ2DANNET_NODE_API const std::set<std::string>& get_group_peers(const std::string& group);
+    MQ2DANNET_NODE_API const std::set<std::string>& get_peer_groups(const std::string& peer);
     MQ2DANNET_NODE_API const std::string get_interfaces();
     MQ2DANNET_NODE_API const std::string get_full_name(const std::string& name);
+    // what get_full_name does, written into buffer instead (and cut off if it doesn't fit), so checking a name allocates nothing
+    static void qualify(const std::string& name, CHAR (&buffer)[MAX_STRING]);
     MQ2DANNET_NODE_API const std::string get_short_name(const std::string& name);
     MQ2DANNET_NODE_API const std::string get_name(const std::string& name);
 
@@ -129,41 +201,240 @@ public:
     static const std::string name() { return T::name(); }
 
     template <typename T>
-    static const std::function<bool(std::stringstream&&)> callback() {
+    static constexpr uint32_t id() { return T::id(); }
+
+    template <typename T>
+    static const std::function<bool(Reader&&)> callback() {
         return T::callback;
     }
 
-    // we gotta trust that copy elision works here, which it should in c++14 or more for stringstream.
-    // worst case is a slightly slower command because we have to copy the stream
+    // Buffer is move only, so this never copies what was serialized
     template <typename T, typename... Args>
-    static std::stringstream pack(Args&&... args) { return T::pack(std::forward<Args>(args)...); }
+    static Buffer pack(Args&&... args) { return T::pack(std::forward<Args>(args)...); }
 
     template <typename T>
-    void register_command() { register_command(name<T>(), callback<T>()); }
+    void register_command() { register_command(id<T>(), name<T>(), callback<T>()); }
 
     template <typename T>
-    void unregister_command() { unregister_command(name<T>()); }
+    void unregister_command() { unregister_command(id<T>()); }
+
+    // register custom commands (for responses), the name is only kept for debugging
+    MQ2DANNET_NODE_API void register_command(uint32_t id, const std::string& name, std::function<bool(Reader&&)> callback);
+    void unregister_command(uint32_t id) { _command_table.erase(id); }
+    std::string command_name(uint32_t id) { return _command_table.name(id); }
+
+    // puts the callback in the pending table and returns the request id the responder should answer with, or 0 if the
+    // table is full. This is generated by the requester, and it's dropped if no answer comes within the expired timeout
+    MQ2DANNET_NODE_API uint32_t register_response(std::function<bool(Reader&&)> callback);
+    std::size_t pending_responses() { return _pending.size(); }
+    void expire_responses();
+    MQ2DANNET_NODE_API void respond(const std::string& name, uint32_t cmd, Buffer&& args);
+    // the same body whispered to every one of names, which only goes through the actor pipe once
+    MQ2DANNET_NODE_API void respond(const std::vector<std::string>& names, uint32_t cmd, Buffer&& args);
+
+    // a query result as it goes over the wire. Simple results keep their MQ2 type so nobody has to parse a string back into
+    // a number, everything else (and anything with a nested ${}) is the string that ParseMacroData gives us
+    struct Value final {
+        enum Kind : unsigned char {
+            String = 0,
+            Int,
+            Int64,
+            Float,
+            Bool,
+            Spawn
+        };
 
-    // register custom commands (for responses)
-    void register_command(const std::string& name, std::function<bool(std::stringstream&&)> callback) { _command_map.upsert(name, callback); }
-    void unregister_command(const std::string& name) { _command_map.erase(name); }
+        Kind kind;
+        __int64 number;   // Int, Int64, Bool, and the spawn id for Spawn
+        float real;       // Float
+        std::string text; // String, and the spawn's name for Spawn so it still prints where the spawn isn't loaded
+
+        Value() : kind(String), number(0), real(0), text("NULL") {}
+        explicit Value(const std::string& text) : kind(String), number(0), real(0), text(text) {}
+        Value(Kind kind, __int64 number) : kind(kind), number(number), real(0) {}
+
+        bool operator==(const Value& rhs) const { return kind == rhs.kind && number == rhs.number && real == rhs.real && text == rhs.text; }
+        bool operator!=(const Value& rhs) const { return !(*this == rhs); }
+
+        const char* type_name() const;
+        MQ2TYPEVAR type_var() const;
+        void to_string(char* Destination) const; // Destination must hold MAX_STRING
+        std::string to_string() const;
+
+        template <class S>
+        void Serialize(const Archive<S>& ar) {
+            ar & static_cast<unsigned char>(kind);
+            switch (kind) {
+            case Int:
+                ar & static_cast<int>(number);
+                break;
+            case Int64:
+                ar & static_cast<long long>(number);
+                break;
+            case Float:
+                ar & real;
+                break;
+            case Bool:
+                ar & (number != 0);
+                break;
+            case Spawn:
+                ar & static_cast<unsigned int>(number) & text;
+                break;
+            default:
+                ar & text;
+                break;
+            }
+        }
 
-    // finds and inserts the next int key, returns `"response" + new_key`
-    // this is generated by the requester
-    MQ2DANNET_NODE_API std::string register_response(std::function<bool(std::stringstream&&)> callback);
-    MQ2DANNET_NODE_API void respond(const std::string& name, const std::string& cmd, std::stringstream&& args);
+        void Serialize(Reader& ar) {
+            unsigned char tag;
+            ar & tag;
+
+            kind = static_cast<Kind>(tag);
+            number = 0;
+            real = 0;
+            text.clear();
+
+            switch (kind) {
+            case String:
+                ar & text;
+                break;
+            case Int: {
+                int v;
+                ar & v;
+                number = v;
+                break;
+            }
+            case Int64: {
+                long long v;
+                ar & v;
+                number = v;
+                break;
+            }
+            case Float:
+                ar & real;
+                break;
+            case Bool: {
+                bool v;
+                ar & v;
+                number = v ? 1 : 0;
+                break;
+            }
+            case Spawn: {
+                unsigned int v;
+                ar & v & text;
+                number = v;
+                break;
+            }
+            default:
+                throw std::runtime_error("unknown value type");
+            }
+        }
+    };
 
     struct Observation final {
         std::string output;
-        std::string data;
+        Value data;
         unsigned __int64 received;
 
         Observation(const Observation& obs) : output(obs.output), data(obs.data), received(obs.received) {}
-        Observation(const std::string& output) : output(output), data("NULL"), received(0) {}
-        Observation(const std::string& output, const std::string& data, unsigned __int64 received) : output(output), data(data), received(received) {}
-        Observation() : output(), data("NULL"), received(0) {}
+        // the copy above would otherwise take the place of a move, and observations get moved around a lot (table slots)
+        Observation(Observation&& obs) = default;
+        Observation& operator=(const Observation& obs) = default;
+        Observation& operator=(Observation&& obs) = default;
+        Observation(const std::string& output) : output(output), data(), received(0) {}
+        Observation(const std::string& output, const Value& data, unsigned __int64 received) : output(output), data(data), received(received) {}
+        Observation() : output(), data(), received(0) {}
+    };
+
+    // a query in its canonical form (escapes undone, no quotes, no ${} wrapper, no surrounding whitespace) along with what
+    // evaluating it needs, so all that is worked out once per distinct query instead of every time it's used
+    struct CompiledQuery final {
+        unsigned int id;     // never reused, even once the query has been dropped
+        std::string query;
+        std::string wrapped; // ${query}, ready for the full parser
+        bool nested;         // has a ${} inside, so it has to go through the full parser
+    };
+
+    // everybody we know about and what groups they're in, as of some membership change. The actor builds a new one every
+    // time something changes and never touches one again once it's published
+    struct Directory final {
+        unsigned int version;
+        std::set<std::string> peers;                              // everybody connected, and us
+        std::set<std::string> groups;                             // every group anybody (including us) is in
+        std::set<std::string> own_groups;
+        std::map<std::string, std::set<std::string>> group_peers; // group name, peer names (including us)
+        std::map<std::string, std::set<std::string>> peer_groups; // peer name, group names (including us)
+        std::map<std::string, std::string, std::less<>> uuids;    // peer name, peer uuid (transparent so a name can be looked up without a string)
+        const std::set<std::string> none;                         // for lookups that don't find anything
+
+        Directory() : version(0) {}
+    };
+
+    // a command and everything needed to run it. The body is either the frame zyre received or a Buffer we packed ourselves,
+    // owned either way so neither the actor thread nor local delivery has to copy it
+    struct Message final {
+        uint32_t id;
+        std::string from;
+        std::string group;
+        zframe_t* frame;                              // owned, set when this came off the wire
+        Buffer buffer;                                // set when this was packed locally
+        std::chrono::steady_clock::time_point queued; // for the pulse stats, so we know how far behind we are
+
+        Message() : id(0), frame(nullptr) {}
+        ~Message() { reset(); }
+
+        Message(uint32_t id, const std::string& from, const std::string& group, zframe_t** frame)
+            : id(id), from(from), group(group), frame(*frame), queued(std::chrono::steady_clock::now()) {
+            *frame = nullptr; // the message owns the frame now
+        }
+
+        Message(uint32_t id, const std::string& from, const std::string& group, Buffer&& buffer)
+            : id(id), from(from), group(group), frame(nullptr), buffer(std::move(buffer)), queued(std::chrono::steady_clock::now()) {}
+
+        Message(Message&& other) noexcept : id(other.id), from(std::move(other.from)), group(std::move(other.group)), frame(other.frame), buffer(std::move(other.buffer)), queued(other.queued) {
+            other.frame = nullptr;
+        }
+
+        Message& operator=(Message&& rhs) noexcept {
+            if (this != &rhs) {
+                reset();
+                id = rhs.id;
+                from = std::move(rhs.from);
+                group = std::move(rhs.group);
+                frame = rhs.frame;
+                buffer = std::move(rhs.buffer);
+                queued = rhs.queued;
+                rhs.frame = nullptr;
+            }
+
+            return *this;
+        }
+
+        // reads straight out of the body, so this is only good for as long as the message is
+        Reader reader() const {
+            if (frame)
+                return Reader(reinterpret_cast<const char*>(zframe_data(frame)), zframe_size(frame), from, group);
+
+            return Reader(buffer, from, group);
+        }
+
+        void reset() {
+            if (frame)
+                zframe_destroy(&frame);
+        }
+
+        Message(const Message&) = delete;
+        Message& operator=(const Message&) = delete;
     };
 
+    // runs T's callback right here on a body packed for group, as if from had sent it. This is how we talk to ourselves
+    template <typename T, typename... Args>
+    static bool deliver(const std::string& from, const std::string& group, Args&&... args) {
+        Message message(id<T>(), from, group, pack<T>(group, std::forward<Args>(args)...));
+        return T::callback(message.reader());
+    }
+
     // finds query and returns the observation group, generates new group name if query not found
     MQ2DANNET_NODE_API std::string register_observer(const std::string& group, const std::string& query);
     MQ2DANNET_NODE_API void unregister_observer(const std::string& query);
@@ -171,48 +442,109 @@ public:
     MQ2DANNET_NODE_API void forget(const std::string& group);
     MQ2DANNET_NODE_API void forget(const std::string& name, const std::string& query);
     MQ2DANNET_NODE_API void forget_all(const std::string& name);
-    MQ2DANNET_NODE_API void update(const std::string& group, const std::string& data, const std::string& output);
+    MQ2DANNET_NODE_API void unsubscribe(const std::string& group, const std::string& name);
+    MQ2DANNET_NODE_API void update(const std::string& group, const Value& data, const std::string& output);
     MQ2DANNET_NODE_API const Observation read(const std::string& group);
     MQ2DANNET_NODE_API const Observation read(const std::string& name, const std::string& query);
+    // no copy, these point right at the stored observation (or are null), so they're only good until the next observe,
+    // forget or update -- which is fine for a TLO access or a command callback, but don't hold on to them
+    MQ2DANNET_NODE_API const Observation* observed(const std::string& group);
+    MQ2DANNET_NODE_API const Observation* observed(const std::string& name, const std::string& query);
+    // same, but takes the query the way it was written (untrimmed) and remembers what it resolved to. Main thread only
+    MQ2DANNET_NODE_API const Observation* observed(const std::string& name, const char* query);
     MQ2DANNET_NODE_API bool can_read(const std::string& name, const std::string& query);
     MQ2DANNET_NODE_API size_t observed_count(const std::string& name);
     MQ2DANNET_NODE_API std::set<std::string> observed_queries(const std::string& name);
     MQ2DANNET_NODE_API size_t observer_count();
     MQ2DANNET_NODE_API std::set<std::string> observer_queries();
     MQ2DANNET_NODE_API std::set<std::string> observers(const std::string& query);
-    MQ2DANNET_NODE_API void publish(const std::string& group, const std::string& cmd, std::stringstream&& args);
+    MQ2DANNET_NODE_API void publish(const std::string& group, uint32_t cmd, Buffer&& args);
 
     template <typename T, typename... Args>
     void publish(Args&&... args) {
-        std::map<unsigned int, Query> updated_values;
+        using namespace std::chrono;
+
+        auto now = MQGetTickCount64();
+        if (_last_publish != 0)
+            _pulse_period = ewma(_pulse_period, static_cast<double>(now - _last_publish));
+        _last_publish = now;
+
+        const auto start = steady_clock::now();
+        const auto budget = microseconds(_observe_budget);
+        std::map<std::string, Value> changed; // observer group, result
+
+        // only observers that are due get looked at, everything else stays put in the schedule
+        while (!_observer_schedule.empty() && _observer_schedule.top().due <= now) {
+            ScheduledObserver due = _observer_schedule.top();
+            _observer_schedule.pop();
+
+            Query observer;
+            if (!_observer_map.find(due.key, observer) || observer.next != due.due)
+                continue; // unregistered (or re-registered) since this was scheduled
+
+            std::string group = observer_group(due.key);
+            // something else already paid for this evaluation in this pulse, so don't let it pull the cost average down
+            auto compiled = compile_query(observer.query);
+            bool memoized = _parse_memo.find(compiled->id) != _parse_memo.end();
+            auto eval_start = steady_clock::now();
+            Value query_result = serve_value(*compiled);
+            double cost = static_cast<double>(duration_cast<microseconds>(steady_clock::now() - eval_start).count());
+
+            bool did_change = !_query_map.contains(observer.id) || _query_map.get(observer.id) != query_result;
+            if (did_change) {
+                _query_map.upsert(observer.id, query_result);
+                changed[group] = query_result;
+            }
 
-        _observer_map.foreach ([this, &updated_values](std::pair<unsigned int, Query> observer) -> void {
-            auto tick = MQGetTickCount64();
-            if (tick - observer.second.last >= std::max<unsigned __int64>(10 * observer.second.benchmark, observe_delay())) { // wait at least a second between updates
-                std::string group = observer_group(observer.first);
-                std::string query_result = parse_query(observer.second.query);
+            if (!memoized)
+                observer.cost = observer.last == 0 ? cost : ewma(observer.cost, cost);
+            observer.churn = ewma(observer.churn, did_change ? 1.0 : 0.0);
+            observer.last = now;
+            std::size_t subscribers = 0;
+            _subscribers.visit(group, [&subscribers](const std::set<std::string>& names) { subscribers = names.size(); });
+            observer.interval = observe_interval(observer, subscribers);
 
-                if (!_query_map.contains(observer.second.query) || _query_map.get(observer.second.query) != query_result) {
-                    _query_map.upsert(observer.second.query, query_result);
-                    shout<T>(group, query_result, std::forward<Args>(args)...);
-                }
+            // a little jitter so observers that started together drift apart
+            schedule_observer(due.key, observer, now + observer.interval + observe_jitter(observer.interval / 10));
 
-                Query new_query(observer.second.query);
+            // anything still due waits for the next pulse once we're over budget (but always do at least one)
+            if (steady_clock::now() - start >= budget)
+                break;
+        }
 
-                auto proc_time = MQGetTickCount64() - tick;
-                if (observer.second.benchmark == 0)
-                    new_query.benchmark = proc_time;
-                else
-                    new_query.benchmark = static_cast<unsigned __int64>(0.5 * (observer.second.benchmark + proc_time));
+        if (changed.empty())
+            return;
 
-                new_query.last = tick;
+        // regroup by subscriber so each peer gets everything it observes in one message, then by what each peer gets so
+        // peers watching the same observers (a raid all watching the tank) share one encoded batch and one trip through
+        // the pipe. The actor still whispers every one of them, since only subscribers should see the values
+        typedef std::vector<const std::pair<const std::string, Value>*> Results;
+        std::map<std::string, Results> wanted; // peer, the changed results it observes
+        for (auto& update : changed) {
+            _subscribers.visit(update.first, [&wanted, &update](const std::set<std::string>& subscribers) {
+                for (auto& peer : subscribers)
+                    wanted[peer].push_back(&update);
+            });
+        }
 
-                updated_values[observer.first] = new_query;
+        std::map<Results, std::vector<std::string>> destinations; // results, peers
+        for (auto& peer : wanted)
+            destinations[peer.second].push_back(peer.first);
+
+        for (auto& destination : destinations) {
+            std::map<std::string, Value> batch; // observer group, result
+            for (auto result : destination.first)
+                batch.emplace(result->first, result->second);
+
+            auto self = std::find(destination.second.begin(), destination.second.end(), _node_name);
+            if (self != destination.second.end()) {
+                // observing self, there's nobody to send this to so it's handed straight to the batch callback
+                deliver<T>(_node_name, std::string(), batch, std::forward<Args>(args)...);
+                destination.second.erase(self);
             }
-        });
 
-        for (auto it = updated_values.begin(); it != updated_values.end(); ++it) {
-            _observer_map.upsert(it->first, it->second);
+            if (!destination.second.empty())
+                respond(destination.second, id<T>(), pack<T>(std::string(), batch, std::forward<Args>(args)...));
         }
     }
 
@@ -237,7 +569,7 @@ private:
             _mutex.lock();
             for (auto it = _vector.begin(); it != _vector.end();) {
                 if (f(*it))
-                    _vector.erase(it);
+                    it = _vector.erase(it);
                 else
                     ++it;
             }
@@ -266,23 +598,24 @@ private:
             _mutex.unlock();
         }
 
-        void emplace(T e) {
+        std::set<T> take() {
+            std::set<T> r;
             _mutex.lock();
-            _set.emplace(e);
+            _set.swap(r);
             _mutex.unlock();
+            return r;
         }
 
-        void erase(T e) {
+        void emplace(T e) {
             _mutex.lock();
-            _set.erase(e);
+            _set.emplace(e);
             _mutex.unlock();
         }
 
-        T get_next(std::function<T(T)> f) {
+        void erase(T e) {
             _mutex.lock();
-            T r = f(*(_set.crbegin()));
+            _set.erase(e);
             _mutex.unlock();
-            return r;
         }
 
         void insert(T& e) {
@@ -292,35 +625,49 @@ private:
         }
     };
 
-    template <typename T>
-    class locked_queue {
+    // latest-value slots -- a put replaces whatever is already waiting under the same key, so the consumer only ever sees
+    // the newest value for each key no matter how many arrived between takes
+    template <typename T, typename U>
+    class locked_mailbox {
     private:
         std::mutex _mutex;
-        std::deque<T> _queue;
+        std::map<T, U> _slots;
 
     public:
-        //emplace empty front pop
-        void emplace(T& e) {
+        // returns true if this replaced a value that was never taken
+        bool put(const T& n, U& e) {
             _mutex.lock();
-            _queue.emplace_front(std::move(e));
+            auto it = _slots.find(n);
+            bool replaced = it != _slots.end();
+            if (replaced)
+                it->second = std::move(e);
+            else
+                _slots.emplace(n, std::move(e));
             _mutex.unlock();
+            return replaced;
         }
 
-        T pop() {
+        // puts back a value that was taken but not consumed, unless a newer one has arrived since
+        void restore(const T& n, U& e) {
             _mutex.lock();
-            T r;
-            if (!_queue.empty()) {
-                r = std::move(_queue.front());
-                _queue.pop_front(); // go ahead and pop it off, we've moved it
-            }
+            if (_slots.find(n) == _slots.end())
+                _slots.emplace(n, std::move(e));
+            _mutex.unlock();
+        }
+
+        std::map<T, U> take() {
+            std::map<T, U> r;
+            _mutex.lock();
+            _slots.swap(r);
             _mutex.unlock();
             return r;
         }
 
-        void remove_if(const std::function<bool(T&)>& f) {
+        std::size_t size() {
             _mutex.lock();
-            std::remove_if(_queue.begin(), _queue.end(), f);
+            std::size_t r = _slots.size();
             _mutex.unlock();
+            return r;
         }
     };
 
@@ -361,6 +708,16 @@ private:
             return position;
         }
 
+        bool find(const T& n, U& r) {
+            _mutex.lock();
+            auto r_it = _map.find(n);
+            bool found = r_it != _map.end();
+            if (found)
+                r = r_it->second;
+            _mutex.unlock();
+            return found;
+        }
+
         U get(const T& n) {
             _mutex.lock();
             U r; // it's default constructed
@@ -371,6 +728,17 @@ private:
             return r;
         }
 
+        // looks at the value in place under the lock instead of copying it out. Don't call back into this map from f
+        bool visit(const T& n, std::function<void(const U&)> f) {
+            _mutex.lock();
+            auto r_it = _map.find(n);
+            bool found = r_it != _map.end();
+            if (found)
+                f(r_it->second);
+            _mutex.unlock();
+            return found;
+        }
+
         bool contains(const T& n) {
             _mutex.lock();
             bool r = (_map.find(n) != _map.end());
@@ -378,6 +746,13 @@ private:
             return r;
         }
 
+        std::size_t size() {
+            _mutex.lock();
+            std::size_t r = _map.size();
+            _mutex.unlock();
+            return r;
+        }
+
         std::set<T, V> keys() {
             _mutex.lock();
             std::set<T, V> r;
@@ -419,13 +794,19 @@ private:
             _mutex.lock();
             for (auto it = _map.begin(); it != _map.end();) {
                 if (f(*it))
-                    _map.erase(it);
+                    it = _map.erase(it);
                 else
                     ++it;
             }
             _mutex.unlock();
         }
 
+        void clear() {
+            _mutex.lock();
+            _map.clear();
+            _mutex.unlock();
+        }
+
         std::map<T, U, V> copy() {
             _mutex.lock();
             std::map<T, U, V> r;
@@ -435,14 +816,41 @@ private:
         }
     };
 
+
     locked_vector<std::function<bool(const std::string&, const std::string&)>> _enter_callbacks;
     locked_vector<std::function<bool(const std::string&, const std::string&)>> _exit_callbacks;
     locked_vector<std::function<bool(const std::string&, const std::string&)>> _join_callbacks;
     locked_vector<std::function<bool(const std::string&, const std::string&)>> _leave_callbacks;
 
-    locked_map<std::string, std::string> _connected_peers;       // peer_name, peer_uuid
-    locked_map<std::string, std::set<std::string>> _peer_groups; // group name, peer_names
-    locked_set<std::string> _own_groups;                         // group name
+    // names only get interned when a peer or group actually shows up (ENTER, JOIN, observing), everything that's just
+    // looking a name up uses find so TLO indices and typos can't grow it
+    symbol_table _symbols;
+
+    // only the actor touches these, everybody else reads the snapshot it publishes from them (which is where they turn
+    // back into strings)
+    std::unordered_map<symbol, std::string> _connected_peers;                // peer, peer_uuid (original case, zyre's peer hash is case sensitive)
+    std::unordered_map<symbol, std::string> _incompatible_peers;             // peer, peer_uuid -- entered on another protocol version
+    std::unordered_map<symbol, std::unordered_set<symbol>> _peer_groups;     // group, peers
+    std::unordered_map<symbol, std::unordered_set<symbol>> _memberships;     // peer, groups -- the other side of _peer_groups
+    std::unordered_set<symbol> _own_groups;                                  // group
+    void add_membership(symbol group, symbol peer);    // actor only
+    void remove_membership(symbol group, symbol peer); // actor only
+    void remove_memberships(symbol peer);              // actor only
+
+    // read-copy-update for the directory. Readers just load the pointer, and the main thread doesn't keep a snapshot past
+    // the pulse it got it in. So once the main thread has started a pulse on some version, anything older that the actor
+    // replaced can go -- the actor frees those the next time it publishes
+    std::atomic<const Directory*> _directory;
+    std::atomic<unsigned int> _quiescent_version;          // newest version the main thread had at the start of its last pulse
+    std::vector<const Directory*> _retired_directories; // actor only
+    void publish_directory();                              // actor only
+
+    // actor only. Membership events mark the directory changed, and it's published once the burst of events that changed it
+    // has been handled (or every max_deferred_events during a long one), so a zone storm builds a handful of snapshots
+    // instead of one per event
+    static const unsigned int max_deferred_events = 64;
+    bool _directory_changed;
+    unsigned int _deferred_events;
 
     // I don't like this, but since zyre/czmq does the memory management for these, I should store these as raw pointers
     zyre_t* _node;
@@ -450,78 +858,160 @@ private:
     zpoller_t* _poller;
 
     // command containers
-    locked_map<std::string, std::function<bool(std::stringstream&& args)>> _command_map; // callback name, callback
-    locked_queue<std::pair<std::string, std::stringstream>> _command_queue;              // pair callback name, callback
-    locked_map<std::string, std::string> _query_map;                                     // query, result
+    command_table _command_table;                                                 // command id, callback
+    mpsc_queue<Message, 1024> _command_queue;                                     // command id, args
+    locked_mailbox<std::pair<std::string, std::string>, Message> _update_mailbox; // (sender, observer group), newest update
+    locked_map<symbol, Value> _query_map;                                         // query, last published result
 
-    locked_set<unsigned char> _response_keys; // ordered number of responses
+    pending_table _pending; // request id, response callback
 
     struct Query final {
         std::string query;
-        unsigned __int64 benchmark;
+        symbol id;                  // query, interned
+        double cost;                // moving average of the evaluation time in us
+        double churn;               // moving average of how often an evaluation changes the value (0 to 1)
+        unsigned __int64 interval;  // current cadence in ms
         unsigned __int64 last;
+        unsigned __int64 next; // the due time this query is scheduled for, anything else in the schedule for it is stale
 
-        //Benchmarks[bmParseMacroParameter];
-
-        Query() = default;
-        Query(const std::string& query) : query(query), benchmark(0), last(0) {}
+        Query() : id(0), cost(0), churn(0.5), interval(0), last(0), next(0) {}
+        Query(const std::string& query, symbol id) : query(query), id(id), cost(0), churn(0.5), interval(0), last(0), next(0) {}
 
         // let's do some copy and swap for a bit of easy optimization
         friend void swap(Query& left, Query& right) {
             using std::swap;
             swap(left.query, right.query);
-            swap(left.benchmark, right.benchmark);
+            swap(left.id, right.id);
+            swap(left.cost, right.cost);
+            swap(left.churn, right.churn);
+            swap(left.interval, right.interval);
             swap(left.last, right.last);
+            swap(left.next, right.next);
         }
 
-        Query(const Query& other) : query(other.query), benchmark(other.benchmark), last(other.last) {}
-        Query(Query&& other) noexcept : query(std::move(other.query)), benchmark(std::move(other.benchmark)), last(std::move(other.last)) {}
+        Query(const Query& other) : query(other.query), id(other.id), cost(other.cost), churn(other.churn), interval(other.interval), last(other.last), next(other.next) {}
+        Query(Query&& other) noexcept : query(std::move(other.query)), id(other.id), cost(other.cost), churn(other.churn), interval(other.interval), last(other.last), next(other.next) {}
         Query& operator=(Query rhs) {
             swap(*this, rhs);
             return *this;
         }
     };
 
-    struct Observed final {
-        std::string query;
-        std::string name;
+    typedef MQ2DanNet::Observed Observed;
 
-        Observed() = default;
-        Observed(const std::string& query, const std::string& name) : query(query), name(name) {}
+    locked_map<unsigned int, Query> _observer_map;                    // group number, query
+    locked_map<symbol, unsigned int> _observer_keys;                  // query, group number
+    locked_map<std::string, std::set<std::string>> _subscribers;      // observer group, subscriber names
+    locked_set<std::string> _entered_peers;                           // peers that entered since the last resubscribe
+    locked_set<std::pair<std::string, std::string>> _rejected_peers;  // peer, protocol it entered with -- not reported yet
 
-        friend void swap(Observed& left, Observed& right) {
-            using std::swap;
-            swap(left.query, right.query);
-            swap(left.name, right.name);
-        }
+    struct ScheduledObserver final {
+        unsigned __int64 due;
+        unsigned int key;
 
-        Observed(const Observed& other) : query(other.query), name(other.name) {}
-        Observed(Observed&& other) noexcept : query(std::move(other.query)), name(std::move(other.name)) {}
-        Observed& operator=(Observed rhs) {
-            swap(*this, rhs);
-            return *this;
-        }
+        bool operator>(const ScheduledObserver& rhs) const { return due > rhs.due; }
     };
 
-    struct ObservedCompare final {
-        bool operator()(const Observed& lhs, const Observed& rhs) const {
-            if (lhs.query != rhs.query)
-                return lhs.query < rhs.query;
-            else
-                return lhs.name < rhs.name;
+    // min-heap of observer due times, only the main thread (register_observer and publish) touches this.
+    // unregistering doesn't remove anything here, publish just skips entries that don't match the observer's next due time
+    std::priority_queue<ScheduledObserver, std::vector<ScheduledObserver>, std::greater<ScheduledObserver>> _observer_schedule;
+    std::minstd_rand _observe_jitter;
+    double _pulse_period;            // moving average of the time between publishes in ms
+    unsigned __int64 _last_publish;
+
+    void schedule_observer(unsigned int key, Query& query, unsigned __int64 due) {
+        query.next = due;
+        _observer_map.upsert(key, query);
+        _observer_schedule.push({ due, key });
+    }
+
+    static double ewma(double average, double sample) { return average + 0.25 * (sample - average); }
+
+    // the cadence controller. Demand scales observe_delay down for queries that change often and have a lot of
+    // subscribers (a query that changes half the time with a single subscriber stays at observe_delay), and the cost
+    // floor keeps every observer inside an equal share of the per-frame budget: cost * frames per interval / observers
+    unsigned __int64 observe_interval(const Query& query, std::size_t subscribers) {
+        double delay = static_cast<double>(observe_delay());
+        double slowest = 10.0 * delay;
+        double fastest = std::max(0.25 * delay, _pulse_period);
+
+        if (subscribers == 0)
+            return static_cast<unsigned __int64>(slowest);
+
+        double demand = (0.5 + query.churn) * std::sqrt(static_cast<double>(subscribers));
+        double interval = delay / demand;
+
+        if (_observe_budget > 0)
+            interval = std::max(interval, query.cost * _pulse_period * _observer_map.size() / _observe_budget);
+
+        return static_cast<unsigned __int64>(std::min(slowest, std::max(fastest, interval)));
+    }
+
+    unsigned __int64 observe_jitter(unsigned __int64 range) {
+        if (range == 0)
+            return 0;
+
+        return std::uniform_int_distribution<unsigned __int64>(0, range - 1)(_observe_jitter);
+    }
+    observation_table<Observation> _observed;
+    // last query answer from each peer. Keyed by strings rather than symbols, since any query anybody answers lands here and
+    // the symbol table never lets go of anything. Capped like the compiled queries below
+    static const std::size_t max_cached_queries = 1024;
+    locked_map<std::pair<std::string, std::string>, Observation> _query_cache; // (peer, trimmed query), last answer
+    std::atomic<unsigned int> _observer_version;                      // bumped whenever observers, subscribers or observed data keys change
+
+    // only the main thread touches these. Compiled queries are keyed by however the query was written, so the same spelling
+    // again is a single hash lookup. TLO indices can make up new queries forever, so the whole thing is dropped once it's big
+    static const std::size_t max_compiled_queries = 4096;
+    std::unordered_map<std::string, std::shared_ptr<const CompiledQuery>> _compiled_queries; // query as given, compiled
+
+    // TLO reads of an observation, keyed the same way. Symbols are never released, so what a spelling resolved to stays good
+    // for as long as we have it; probing with (peer, char*) means a hit doesn't build a string either
+    struct ObservedSpellingCompare final {
+        typedef void is_transparent;
+        typedef std::pair<std::string, std::string> key;
+        typedef std::pair<const std::string*, const char*> probe;
+
+        bool operator()(const key& lhs, const key& rhs) const { return lhs < rhs; }
+
+        bool operator()(const key& lhs, const probe& rhs) const {
+            int c = lhs.first.compare(*rhs.first);
+            return c < 0 || (c == 0 && lhs.second.compare(rhs.second) < 0);
+        }
+
+        bool operator()(const probe& lhs, const key& rhs) const {
+            int c = lhs.first->compare(rhs.first);
+            return c < 0 || (c == 0 && rhs.second.compare(lhs.second) > 0);
         }
     };
+    static const std::size_t max_observed_spellings = 4096;
+    std::map<std::pair<std::string, std::string>, Observed, ObservedSpellingCompare> _observed_spellings; // (peer, query as given), key
+    unsigned int _last_query_id;
 
-    locked_map<unsigned int, Query> _observer_map;                    // group number, query
-    locked_map<Observed, std::string, ObservedCompare> _observed_map; // maps query to group (for data access)
-    locked_map<std::string, Observation> _observed_data;              // maps group to query result (could be empty)
+    // cleared at the start of every pulse (and whenever we run a command for a peer)
+    std::unordered_map<unsigned int, Value> _parse_memo; // compiled query id, result
+    unsigned int _query_max_age;
+    unsigned int _query_cache_hits;
+    unsigned int _query_cache_misses;
 
     static void node_actor(zsock_t* pipe, void* args);
     const std::string observer_group(const unsigned int key);
-    void queue_command(const std::string& command, std::stringstream&& args);
-
-    std::string _current_query; // for the Query data member
-    Observation _query_result;
+    void queue_command(uint32_t command, const std::string& from, const std::string& group, zframe_t** body);
+    void send_command(const char* type, const std::string& target, uint32_t cmd, Buffer&& args);
+    void send_command(const char* type, const std::vector<std::string>& targets, uint32_t cmd, Buffer&& args);
+    void send_body(uint32_t cmd, Buffer&& args);
+    void queue_message(const std::string& from, const std::string& group, zmsg_t** message);
+
+    // every /dquery request gets its own result slot under a handle, the oldest are dropped once there are too many
+    static const unsigned int max_query_results = 256;
+    locked_map<unsigned int, Observation> _query_results; // handle, result
+    std::vector<unsigned int> _query_batch;                // handles issued by the last /dquery
+    unsigned int _last_query_handle;
+
+    // the last /dgquery -- every peer that was in the group when it went out, and whatever they've answered so far
+    std::set<std::string> _group_query_peers;
+    locked_map<std::string, Observation> _group_query_results; // peer name, result
+    unsigned int _group_query_id;                              // so answers to an older /dgquery are ignored
 
     locked_set<std::string> _rejoin_groups;
 
@@ -531,6 +1021,8 @@ private:
     bool _full_names;
     bool _front_delimiter;
     unsigned int _observe_delay;
+    unsigned int _pulse_budget;
+    unsigned int _observe_budget;
     unsigned int _keepalive;
     unsigned int _evasive;
     unsigned int _expired;
@@ -547,26 +1039,13 @@ private:
 
     // this is a private helper function ONLY THE STATIC ACTOR FUNCTION SHOULD CALL THIS
     std::string peer_uuid(const std::string& name) {
-        std::string full_name = get_full_name(name);
-        std::string uuid;
-        zlist_t* peers = zyre_peers(_node);
-
-        if (peers) {
-            const char* z_peer = reinterpret_cast<const char*>(zlist_first(peers));
-            while (z_peer) {
-                std::string peer_name(zyre_peer_header_value(_node, z_peer, "name"));
-                if (full_name == peer_name) {
-                    uuid = z_peer;
-                    break;
-                }
-
-                z_peer = reinterpret_cast<const char*>(zlist_next(peers));
-            }
-
-            zlist_destroy(&peers);
-        }
+        CHAR full_name[MAX_STRING];
+        qualify(name, full_name);
+        auto uuid_it = _connected_peers.find(_symbols.find(full_name));
+        if (uuid_it != _connected_peers.end())
+            return uuid_it->second;
 
-        return uuid;
+        return std::string();
     }
 
 
@@ -574,11 +1053,20 @@ public:
     // IMPORTANT: these are not exposed as an API, this is on purpose! We need a single point of control for our node (this plugin)
     std::string name() { return _node_name; }
 
+    const Directory& directory() { return *_directory.load(std::memory_order_acquire); }
+    unsigned int observer_version() { return _observer_version.load(std::memory_order_acquire); }
+
+    // the main thread calls this at the start of every pulse, when it can't be holding on to any snapshot
+    void quiescent() { _quiescent_version.store(directory().version, std::memory_order_release); }
+
     bool has_peer(const std::string& peer) {
-        if (_node_name == get_full_name(peer))
+        CHAR full_name[MAX_STRING];
+        qualify(peer, full_name);
+        if (_node_name == full_name)
             return true;
 
-        return _connected_peers.contains(get_full_name(peer));
+        const Directory& current = directory();
+        return current.uuids.find(static_cast<const char*>(full_name)) != current.uuids.end();
     }
 
     size_t peers() {
@@ -586,17 +1074,47 @@ public:
     }
 
     bool is_in_group(const std::string& group) {
-        auto groups = get_own_groups();
+        const std::set<std::string>& groups = get_own_groups();
         return groups.find(group) != groups.end();
     }
 
-    // smartly reads/sets/clears _current_query
-    Observation query(const std::string& output, const std::string& query);
-    Observation query();
-    void query_result(const Observation& obs);
-    std::string trim_query(const std::string& query);
+    // hands out a new handle with an empty result that will go to output
+    unsigned int query_handle(const std::string& output);
+    bool query(unsigned int handle, Observation& obs);
+    Observation query(); // the last handle issued
+    void query_result(unsigned int handle, const Observation& obs);
+    void query_drop(unsigned int handle) { _query_results.erase(handle); } // never going to be answered, so it reads as NULL
+    void query_batch(const std::vector<unsigned int>& handles) { _query_batch = handles; }
+    const std::vector<unsigned int>& query_batch() { return _query_batch; }
+    std::size_t query_pending(); // how many of the last batch haven't been answered yet
+
+    // the freshest answer we have for query on name, whether it came from a query or an observer. False if there isn't one
+    // that's at most max_age ms old
+    bool cached_query(const std::string& name, const std::string& query, unsigned __int64 max_age, Observation& obs);
+    void cache_query(const std::string& name, const std::string& query, const Observation& obs);
+    unsigned int query_cache_hits() { return _query_cache_hits; }
+    unsigned int query_cache_misses() { return _query_cache_misses; }
+
+    // one shout of query to everybody in group, replacing the last group query. Returns false if nobody is in the group
+    bool group_query(const std::string& group, const std::string& query);
+    bool group_query(const std::string& peer, Observation& obs);
+    const std::set<std::string>& group_query_peers() { return _group_query_peers; }
+    std::size_t group_query_pending();
+
+    // $\{ is how macros keep an expression from being parsed before it's sent, this turns it back into ${
+    static std::string unescape(const std::string& text);
+    static std::string canonical_query(const std::string& query);
+    std::shared_ptr<const CompiledQuery> compile_query(const std::string& query);
+    std::string trim_query(const std::string& query) { return compile_query(query)->query; }
     std::string parse_query(const std::string& query);
-    MQ2TYPEVAR parse_response(const std::string& output, const std::string& data);
+    Value parse_value(const std::string& query) { return parse_value(*compile_query(query)); }
+    Value parse_value(const CompiledQuery& query);
+    // parse_value for answering peers. The result is kept for the rest of the pulse so any number of peers asking the same
+    // thing costs a single evaluation
+    Value serve_value(const std::string& query) { return serve_value(*compile_query(query)); }
+    Value serve_value(const CompiledQuery& query);
+    void clear_parse_memo() { _parse_memo.clear(); }
+    MQ2TYPEVAR parse_response(const std::string& output, const Value& data);
     std::string peer_address(const std::string& name);
 
     bool debugging(bool debugging) {
@@ -635,6 +1153,47 @@ public:
     }
     unsigned int observe_delay() { return _observe_delay; }
 
+    // in ms, how old a cached answer can be for /dquery to use it instead of asking. 0 always asks
+    unsigned int query_max_age(unsigned int query_max_age) {
+        _query_max_age = query_max_age;
+        return _query_max_age;
+    }
+    unsigned int query_max_age() { return _query_max_age; }
+
+    // in microseconds per pulse, 0 turns off the cost floor and evaluates one due observer per pulse
+    unsigned int observe_budget(unsigned int observe_budget) {
+        _observe_budget = observe_budget;
+        return _observe_budget;
+    }
+    unsigned int observe_budget() { return _observe_budget; }
+
+    struct ObserverRate final {
+        unsigned int interval;    // current cadence in ms
+        unsigned int cost;        // average evaluation time in us
+        unsigned int churn;       // percent of evaluations that changed the value
+        unsigned int subscribers; // peers in the observer group
+    };
+
+    MQ2DANNET_NODE_API bool observer_rate(const std::string& query, ObserverRate& rate);
+
+    // in microseconds, 0 means one command per pulse
+    unsigned int pulse_budget(unsigned int pulse_budget) {
+        _pulse_budget = pulse_budget;
+        return _pulse_budget;
+    }
+    unsigned int pulse_budget() { return _pulse_budget; }
+
+    struct PulseStats final {
+        unsigned int drained;   // commands dispatched during the last pulse
+        unsigned int deferred;  // commands left in the queue when the budget ran out
+        unsigned __int64 oldest; // longest time (us) a command dispatched during the last pulse sat in the queue
+    };
+
+    const PulseStats& pulse_stats() { return _pulse_stats; }
+
+    std::size_t inbox_overflow() { return _command_queue.overflow(); }
+    std::size_t inbox_high_water() { return _command_queue.high_water(); }
+
     unsigned int keepalive(unsigned int keepalive) {
         _keepalive = keepalive;
         if (_actor)
@@ -677,7 +1236,11 @@ public:
     void recv();
 
     void do_next();
-    void remove_commands(const std::function<bool(std::pair<std::string, std::stringstream>&)>& f);
+    void resubscribe();
+    void report_rejected();
+
+private:
+    PulseStats _pulse_stats;
 };
 }
 
@@ -686,16 +1249,67 @@ public:
 #pragma region CommandDefs
 
 namespace MQ2DanNet {
-COMMAND(Echo, const std::string& message);
+// how a schema field is written. A View only exists to read a string in place, so it goes out as the string it came from
+template <typename T>
+struct wire_field { typedef T type; };
+
+template <>
+struct wire_field<Node::View> { typedef std::string type; };
+
+// implicit conversions only, so passing something that isn't the schema's field fails to compile instead of changing the wire
+template <typename T>
+const T& as_field(const T& v) { return v; }
+
+template <typename Fields, std::size_t... I, typename... Args>
+void write_fields(const Archive<Node::Buffer>& send, std::index_sequence<I...>, const Args&... args) {
+    int unused[] = { 0, ((void)(send << as_field<typename wire_field<typename std::tuple_element<I, Fields>::type>::type>(args)), 0)... };
+    (void)unused;
+}
+
+template <typename Fields, typename... Args>
+Node::Buffer encode_fields(const Args&... args) {
+    static_assert(sizeof...(Args) == std::tuple_size<Fields>::value, "encode takes exactly the fields in the command's schema");
+
+    Node::Buffer send_buffer;
+    Archive<Node::Buffer> send(send_buffer);
+    write_fields<Fields>(send, std::index_sequence_for<Args...>(), args...);
+
+    return send_buffer;
+}
+
+// braced initializers are evaluated in order, so the fields are read in the order they were written
+template <typename Fields, std::size_t... I>
+void read_fields(Node::Reader& args, Fields& fields, std::index_sequence<I...>) {
+    int unused[] = { 0, ((void)(args >> std::get<I>(fields)), 0)... };
+    (void)unused;
+}
+
+// throws std::runtime_error on a malformed body, same as reading the fields by hand
+template <typename Fields>
+Fields unpack_fields(Node::Reader& args) {
+    Fields fields;
+    read_fields(args, fields, std::make_index_sequence<std::tuple_size<Fields>::value>());
 
-COMMAND(Execute, const std::string& command);
+    return fields;
+}
+
+COMMAND(Echo, (const std::string& message), Node::View);
+
+COMMAND(Execute, (const std::string& command), std::string);
+
+// NOTE: Query is asynchronous. The handle stays on this client, only the response key and the request go out
+COMMAND(Query, (const std::string& request, unsigned int handle), uint32_t, std::string);
 
-// NOTE: Query is asynchronous
-COMMAND(Query, const std::string& request);
+// the output variable stays here too, the observed peer only sees the response key and the trimmed query
+COMMAND(Observe, (const std::string& query, const std::string& output), uint32_t, std::string);
 
-COMMAND(Observe, const std::string& query, const std::string& output);
+COMMAND(Update, (const Node::Value& result), Node::Value);
 
-COMMAND(Update, const std::string& result);
+// all the observer results that changed in a pulse for a single subscriber, keyed by observer group
+COMMAND(UpdateBatch, (const std::map<std::string, Node::Value>& results), std::map<std::string, Node::Value>);
+
+// tells the observed peer to stop sending us updates for an observer group
+COMMAND(Forget, (const std::string& group), std::string);
 }
 
 #pragma endregion
@@ -735,54 +1349,65 @@ MQ2DANNET_NODE_API void MQ2DanNet::Node::on_leave(std::function<bool(const std::
     _leave_callbacks.push_back(std::move(callback));
 }
 
-MQ2DANNET_NODE_API void Node::publish(const std::string& group, const std::string& cmd, std::stringstream&& args) {
-    if (!_actor)
-        return;
-
-    args.seekg(0, args.end);
-    size_t args_size = (size_t)args.tellg();
-    args.seekg(0, args.beg);
-
-    char* args_buf = new char[args_size];
-    args.read(args_buf, args_size);
-
-    zframe_t* args_frame = zframe_new(args_buf, args_size);
-
-    zmsg_t* msg = zmsg_new();
-    zmsg_prepend(msg, &args_frame);
-    zmsg_pushstr(msg, cmd.c_str());
-
-    zmsg_pushstr(msg, group.c_str());
-    zmsg_pushstr(msg, "SHOUT");
+MQ2DANNET_NODE_API void Node::publish(const std::string& group, uint32_t cmd, Buffer&& args) {
+    send_command("SHOUT", group, cmd, std::move(args));
+}
 
-    zmsg_send(&msg, _actor);
+MQ2DANNET_NODE_API void Node::respond(const std::string& name, uint32_t cmd, Buffer&& args) {
+    send_command("WHISPER", name, cmd, std::move(args));
+}
 
-    delete[] args_buf;
+MQ2DANNET_NODE_API void Node::respond(const std::vector<std::string>& names, uint32_t cmd, Buffer&& args) {
+    if (names.size() == 1)
+        send_command("WHISPER", names.front(), cmd, std::move(args));
+    else if (!names.empty())
+        send_command("WHISPERS", names, cmd, std::move(args));
 }
 
-MQ2DANNET_NODE_API void Node::respond(const std::string& name, const std::string& cmd, std::stringstream&& args) {
+// czmq 4.2 doesn't have zframe_frommem outside of the draft API, so the body goes out as a zmq message that takes the buffer's
+// storage with a free callback. The actor receives it as an ordinary frame. The command id goes ahead of it big endian.
+void Node::send_command(const char* type, const std::string& target, uint32_t cmd, Buffer&& args) {
     if (!_actor)
         return;
 
-    args.seekg(0, args.end);
-    size_t args_size = (size_t)args.tellg();
-    args.seekg(0, args.beg);
-
-    char* args_buf = new char[args_size];
-    args.read(args_buf, args_size);
+    zstr_sendm(_actor, type);
+    zstr_sendm(_actor, target.c_str());
+    send_body(cmd, std::move(args));
+}
 
-    zframe_t* args_frame = zframe_new(args_buf, args_size);
+// a count goes ahead of the targets so the actor knows where they stop and the command starts
+void Node::send_command(const char* type, const std::vector<std::string>& targets, uint32_t cmd, Buffer&& args) {
+    if (!_actor)
+        return;
 
-    zmsg_t* msg = zmsg_new();
-    zmsg_prepend(msg, &args_frame);
-    zmsg_pushstr(msg, cmd.c_str());
+    zstr_sendm(_actor, type);
+    zstr_sendfm(_actor, "%zu", targets.size());
+    for (auto& target : targets)
+        zstr_sendm(_actor, target.c_str());
+    send_body(cmd, std::move(args));
+}
 
-    zmsg_pushstr(msg, name.c_str());
-    zmsg_pushstr(msg, "WHISPER");
+void Node::send_body(uint32_t cmd, Buffer&& args) {
+    unsigned char id[sizeof(cmd)] = {
+        static_cast<unsigned char>(cmd >> 24), static_cast<unsigned char>(cmd >> 16),
+        static_cast<unsigned char>(cmd >> 8), static_cast<unsigned char>(cmd)
+    };
+    zmq_send(zsock_resolve(_actor), id, sizeof(id), ZMQ_SNDMORE);
 
-    zmsg_send(&msg, _actor);
+    zmq_msg_t body;
+    std::size_t size = args.size();
+    if (size == 0) {
+        zmq_msg_init(&body);
+    } else {
+        char* data = args.release();
+        if (zmq_msg_init_data(&body, data, size, [](void* buffer, void* hint) { free(buffer); }, nullptr) != 0) {
+            free(data);
+            zmq_msg_init(&body); // still have to finish the message we started
+        }
+    }
 
-    delete[] args_buf;
+    if (zmq_msg_send(&body, zsock_resolve(_actor), 0) == -1)
+        zmq_msg_close(&body);
 }
 
 MQ2DANNET_NODE_API const std::list<std::string> Node::get_info() {
@@ -790,14 +1415,9 @@ MQ2DANNET_NODE_API const std::list<std::string> Node::get_info() {
         return std::list<std::string>{ "NONET" };
 
     std::list<std::string> output;
-    std::set<std::string> groups = get_own_groups();
+    const std::set<std::string>& groups = get_own_groups();
     output.push_back("CHANNELS: ");
-    auto group_peers = get_group_peers();
-    for (auto group : group_peers) {
-        // this is our "observer" group filter
-        if (group.first.find_first_of('_') != std::string::npos && std::isdigit(group.first.back()))
-            continue;
-
+    for (auto& group : get_group_peers()) {
         std::stringstream output_stream;
 
         if (groups.find(group.first) != groups.end()) {
@@ -822,54 +1442,119 @@ MQ2DANNET_NODE_API const std::list<std::string> Node::get_info() {
     return output;
 }
 
-MQ2DANNET_NODE_API const std::set<std::string> MQ2DanNet::Node::get_peers() {
-    std::set<std::string> peers = _connected_peers.keys();
-    peers.emplace(_node_name);
+MQ2DANNET_NODE_API const std::set<std::string>& MQ2DanNet::Node::get_peers() {
+    return directory().peers;
+}
 
-    return peers;
+MQ2DANNET_NODE_API const std::set<std::string>& MQ2DanNet::Node::get_all_groups() {
+    return directory().groups;
 }
 
-MQ2DANNET_NODE_API const std::set<std::string> MQ2DanNet::Node::get_all_groups() {
-    std::set<std::string> groups = _peer_groups.keys();
-    std::set<std::string> own_groups = _own_groups.copy();
-    groups.insert(own_groups.cbegin(), own_groups.cend());
+MQ2DANNET_NODE_API const std::set<std::string>& MQ2DanNet::Node::get_own_groups() {
+    return directory().own_groups;
+}
 
-    return groups;
+MQ2DANNET_NODE_API const std::map<std::string, std::set<std::string>>& MQ2DanNet::Node::get_group_peers() {
+    return directory().group_peers;
 }
 
-MQ2DANNET_NODE_API const std::set<std::string> MQ2DanNet::Node::get_own_groups() {
-    return _own_groups.copy();
+MQ2DANNET_NODE_API const std::set<std::string>& MQ2DanNet::Node::get_group_peers(const std::string& group) {
+    const Directory& current = directory();
+    auto group_it = current.group_peers.find(group);
+    return group_it != current.group_peers.end() ? group_it->second : current.none;
 }
 
-MQ2DANNET_NODE_API const std::map<std::string, std::set<std::string>> MQ2DanNet::Node::get_group_peers() {
-    std::map<std::string, std::set<std::string>> group_peers;
+MQ2DANNET_NODE_API const std::set<std::string>& MQ2DanNet::Node::get_peer_groups(const std::string& peer) {
+    const Directory& current = directory();
+    auto peer_it = current.peer_groups.find(peer);
+    return peer_it != current.peer_groups.end() ? peer_it->second : current.none;
+}
 
-    std::set<std::string> groups = get_all_groups();
-    for (auto group : groups) {
-        group_peers[group] = get_group_peers(group);
+void MQ2DanNet::Node::add_membership(symbol group, symbol peer) {
+    _peer_groups[group].emplace(peer);
+    _memberships[peer].emplace(group);
+}
+
+void MQ2DanNet::Node::remove_membership(symbol group, symbol peer) {
+    auto group_it = _peer_groups.find(group);
+    if (group_it != _peer_groups.end()) {
+        group_it->second.erase(peer);
+        if (group_it->second.empty())
+            _peer_groups.erase(group_it);
     }
 
-    return group_peers;
+    auto peer_it = _memberships.find(peer);
+    if (peer_it != _memberships.end()) {
+        peer_it->second.erase(group);
+        if (peer_it->second.empty())
+            _memberships.erase(peer_it);
+    }
 }
 
-MQ2DANNET_NODE_API const std::set<std::string> MQ2DanNet::Node::get_group_peers(const std::string& group) {
-    std::set<std::string> peers = _peer_groups.get(group);
+void MQ2DanNet::Node::remove_memberships(symbol peer) {
+    auto peer_it = _memberships.find(peer);
+    if (peer_it == _memberships.end())
+        return;
 
-    if (is_in_group(group))
-        peers.emplace(_node_name);
+    // only touch the groups this peer was actually in
+    for (auto group : peer_it->second) {
+        auto group_it = _peer_groups.find(group);
+        if (group_it != _peer_groups.end()) {
+            group_it->second.erase(peer);
+            if (group_it->second.empty())
+                _peer_groups.erase(group_it);
+        }
+    }
 
-    return peers;
+    _memberships.erase(peer_it);
 }
 
-MQ2DANNET_NODE_API const std::set<std::string> MQ2DanNet::Node::get_peer_groups(const std::string& peer) {
-    std::set<std::string> groups;
+void MQ2DanNet::Node::publish_directory() {
+    _directory_changed = false;
+    _deferred_events = 0;
 
-    _peer_groups.foreach ([&groups, peer](std::pair<std::string, std::set<std::string>> p) -> void {
-        if (p.second.find(peer) != p.second.end())
-            groups.emplace(p.first);
-    });
+    Directory* next = new Directory();
+    next->version = directory().version + 1;
+
+    for (auto& peer : _connected_peers) {
+        const std::string& name = _symbols.name(peer.first);
+        next->peers.emplace(name);
+        next->uuids.emplace(name, peer.second);
+    }
+    next->peers.emplace(_node_name);
+
+    for (auto& group : _peer_groups) {
+        std::set<std::string>& peers = next->group_peers[_symbols.name(group.first)];
+        for (auto peer : group.second)
+            peers.emplace(_symbols.name(peer));
+    }
+
+    for (auto& peer : _memberships) {
+        std::set<std::string>& groups = next->peer_groups[_symbols.name(peer.first)];
+        for (auto group : peer.second)
+            groups.emplace(_symbols.name(group));
+    }
+
+    for (auto group : _own_groups) {
+        const std::string& name = _symbols.name(group);
+        next->own_groups.emplace(name);
+        next->group_peers[name].emplace(_node_name);
+        next->peer_groups[_node_name].emplace(name);
+    }
+
+    for (auto& group : next->group_peers)
+        next->groups.emplace(group.first);
 
-    return groups;
+    _retired_directories.push_back(_directory.exchange(next, std::memory_order_acq_rel));
+
+    unsigned int quiescent = _quiescent_version.load(std::memory_order_acquire);
+    _retired_directories.erase(std::remove_if(_retired_directories.begin(), _retired_directories.end(), [quiescent](const Directory* retired) {
+        if (retired->version >= quiescent)
+            return false;
+
+        delete retired;
+        return true;
+    }), _retired_directories.end());
 }
 
 MQ2DANNET_NODE_API const std::string MQ2DanNet::Node::get_interfaces() {
@@ -902,15 +1587,26 @@ MQ2DANNET_NODE_API const std::string MQ2DanNet::Node::get_interfaces() {
 }
 
 MQ2DANNET_NODE_API const std::string MQ2DanNet::Node::get_full_name(const std::string& name) {
-    std::string ret = name;
+    CHAR full_name[MAX_STRING];
+    qualify(name, full_name);
+    return full_name;
+}
+
+void MQ2DanNet::Node::qualify(const std::string& name, CHAR (&buffer)[MAX_STRING]) {
+    std::size_t length = 0;
 
     // this works because names and servers can't have underscores in them, therefore if
     // there is no underscore in the string, we assume a local character name was passed
     if (std::string::npos == name.find_last_of("_")) {
-        ret = EQADDR_SERVERNAME + std::string("_") + ret;
+        for (const char* c = EQADDR_SERVERNAME; *c && length < MAX_STRING - 2; ++c)
+            buffer[length++] = static_cast<char>(::tolower(static_cast<unsigned char>(*c)));
+        buffer[length++] = '_';
     }
 
-    return init_string(ret.c_str());
+    for (std::size_t i = 0; i < name.size() && length < MAX_STRING - 1; ++i)
+        buffer[length++] = static_cast<char>(::tolower(static_cast<unsigned char>(name[i])));
+
+    buffer[length] = '\0';
 }
 
 MQ2DANNET_NODE_API const std::string MQ2DanNet::Node::get_short_name(const std::string& name) {
@@ -948,6 +1644,7 @@ void Node::node_actor(zsock_t* pipe, void* args) {
 
     // send our node name for easier name recognition
     zyre_set_header(node->_node, "name", "%s", node->_node_name.c_str());
+    zyre_set_header(node->_node, "protocol", "%u", protocol_version);
     zyre_start(node->_node);
     if (node->evasive() > 0)
         zyre_set_evasive_timeout(node->_node, node->evasive());
@@ -964,10 +1661,12 @@ void Node::node_actor(zsock_t* pipe, void* args) {
     node->_rejoin_groups.clear();
 
     for (auto group : groups) {
-        node->_own_groups.emplace(group);
+        node->_own_groups.emplace(node->_symbols.intern(group));
         zyre_join(node->_node, group.c_str());
     }
 
+    node->publish_directory();
+
     // TODO: This doesn't appear necessary, but experiment with it
     //zpoller_set_nonstop(poller, true);
 
@@ -975,12 +1674,18 @@ void Node::node_actor(zsock_t* pipe, void* args) {
 
     bool terminated = false;
     while (!terminated) {
-        void* which = zpoller_wait(poller, keepalive);
+        if (node->_directory_changed && ++node->_deferred_events >= max_deferred_events)
+            node->publish_directory();
+
+        // with a change waiting, only look for more events that are already here -- nothing left means the burst is over
+        void* which = zpoller_wait(poller, node->_directory_changed ? 0 : keepalive);
 
         bool did_expire = zpoller_expired(poller);
         bool did_terminate = zpoller_terminated(poller);
 
-        if (did_expire) {
+        if (did_expire && node->_directory_changed) {
+            node->publish_directory();
+        } else if (did_expire) {
             zsock_signal(pipe, 0);
             int rc = zsock_wait(pipe);
             if (rc != 0)
@@ -1006,14 +1711,16 @@ void Node::node_actor(zsock_t* pipe, void* args) {
             } else if (streq(command, "JOIN")) {
                 char* group = zmsg_popstr(msg);
                 if (group) {
-                    node->_own_groups.emplace(group);
+                    node->_own_groups.emplace(node->_symbols.intern(group));
+                    node->_directory_changed = true;
                     zyre_join(node->_node, group);
                     zstr_free(&group);
                 }
             } else if (streq(command, "LEAVE")) {
                 char* group = zmsg_popstr(msg);
                 if (group) {
-                    node->_own_groups.erase(group);
+                    node->_own_groups.erase(node->_symbols.find(group));
+                    node->_directory_changed = true;
                     zyre_leave(node->_node, group);
                     zstr_free(&group);
                 }
@@ -1031,6 +1738,32 @@ void Node::node_actor(zsock_t* pipe, void* args) {
                     if (!uuid.empty())
                         zyre_whisper(node->_node, uuid.c_str(), &msg);
                 }
+            } else if (streq(command, "WHISPERS")) {
+                char* count = zmsg_popstr(msg);
+                std::size_t remaining = count ? strtoul(count, nullptr, 10) : 0;
+                if (count)
+                    zstr_free(&count);
+
+                std::vector<std::string> uuids;
+                for (; remaining > 0; --remaining) {
+                    char* name = zmsg_popstr(msg);
+                    if (!name)
+                        break;
+
+                    std::string uuid = node->peer_uuid(name);
+                    zstr_free(&name);
+                    if (!uuid.empty())
+                        uuids.push_back(uuid);
+                }
+
+                // zyre takes the message it whispers, so everyone but the last gets a copy
+                for (std::size_t i = 0; i < uuids.size(); ++i) {
+                    if (i + 1 < uuids.size()) {
+                        zmsg_t* copy = zmsg_dup(msg);
+                        zyre_whisper(node->_node, uuids[i].c_str(), &copy);
+                    } else
+                        zyre_whisper(node->_node, uuids[i].c_str(), &msg);
+                }
             } else if (streq(command, "PEER")) {
                 char* name = zmsg_popstr(msg);
                 std::string uuid;
@@ -1166,30 +1899,8 @@ void Node::node_actor(zsock_t* pipe, void* args) {
             } else if (streq(command, "PING")) {
                 zsock_signal(pipe, 0);
             } else {
-                zframe_t* body = zmsg_pop(msg);
-                char* name = zmsg_popstr(msg);
-                char* group = zmsg_popstr(msg);
-
-                if (body) {
-                    std::stringstream args;
-                    Archive<std::stringstream> args_ar(args);
-                    args_ar << std::string(name ? name : "") << std::string(group ? group : "");
-                    char* body_data = (char*)zframe_data(body);
-                    size_t body_size = zframe_size(body);
-
-                    args.write(body_data, body_size);
-
-                    node->queue_command(command, std::move(args));
-                } else {
-                    DebugSpewAlways("MQ2DanNet: Empty %s message in pipe handler: group %s, name %s, body %s.", command, group, name, body);
-                }
-
-                if (group)
-                    zstr_free(&group);
-                if (name)
-                    zstr_free(&name);
-                if (body)
-                    zframe_destroy(&body);
+                // remote commands don't come through here anymore, they get queued directly from the zyre handler below
+                DebugSpewAlways("MQ2DanNet: Unknown command %s in pipe handler.", command);
             }
 
             if (command)
@@ -1206,37 +1917,61 @@ void Node::node_actor(zsock_t* pipe, void* args) {
             const char* szEventType = zyre_event_type(z_event);
             std::string event_type(szEventType ? szEventType : ""); // don't use init_string() because we don't want to make lower
             std::string name = init_string(zyre_event_peer_name(z_event));
+            // only a peer showing up gets a new symbol, anything else about a name we never saw has nothing to touch
+            symbol peer = name.empty() ? 0 : event_type == "ENTER" || event_type == "JOIN" ? node->_symbols.intern(name) : node->_symbols.find(name);
 
             if (event_type.empty()) {
                 DebugSpewAlways("MQ2DanNet: Got zyre message with empty event type!");
             } else if (name.empty()) {
                 DebugSpewAlways("MQ2DanNet: Got %s message with empty name!", event_type.c_str());
             } else if (event_type == "ENTER") {
-                // TODO: can possibly do something with headers here (`zyre_event_headers(z_event)`)
-                // can also harvest the IP:port if we need it
-                std::string uuid = init_string(zyre_event_peer_uuid(z_event));
-                if (uuid.empty()) {
+                // TODO: can also harvest the IP:port if we need it
+                const char* szUuid = zyre_event_peer_uuid(z_event);
+                const char* szProtocol = zyre_event_header(z_event, "protocol");
+                if (!szUuid || szUuid[0] == '\0') {
                     DebugSpewAlways("MQ2DanNet: ENTER with empty UUID for name %s, will not add to peers list.", name.c_str());
+                } else if (!szProtocol || strtoul(szProtocol, nullptr, 10) != protocol_version) {
+                    // its commands don't mean the same thing to us (or ours to it), so it isn't a peer we can route to and
+                    // nothing it sends is queued until it comes back on our version
+                    DebugSpewAlways("MQ2DanNet: %s entered with protocol %s, we're on %u, ignoring it.", name.c_str(), szProtocol ? szProtocol : "(none)", protocol_version);
+                    if (node->_connected_peers.erase(peer) != 0) {
+                        node->remove_memberships(peer);
+                        node->_directory_changed = true;
+                    }
+
+                    node->_incompatible_peers[peer] = szUuid;
+                    node->_rejected_peers.emplace(std::make_pair(name, std::string(szProtocol ? szProtocol : "")));
                 } else {
-                    node->_connected_peers.upsert(name, uuid);
+                    node->_incompatible_peers.erase(peer);
+                    node->_connected_peers[peer] = szUuid;
+                    node->_entered_peers.emplace(name);
+                    node->_directory_changed = true;
                 }
                 //DebugSpewAlways("%s is ENTERing.", name.c_str());
             } else if (event_type == "EXIT") {
-                node->_connected_peers.erase(name);
-
-                std::map<std::string, std::set<std::string>> new_groups;
-                node->_peer_groups.foreach ([&name, &new_groups](std::pair<std::string, std::set<std::string>> group) -> void {
-                    std::set<std::string> new_set = group.second;
-                    if (new_set.erase(name) > 0) {
-                        new_groups[group.first] = new_set;
+                // a peer that restarted can ENTER with its new uuid before the old one EXITs (the old one has to expire if
+                // its leave got lost), so a late EXIT for the old session can't touch anything the new one set up
+                const char* szUuid = zyre_event_peer_uuid(z_event);
+                auto incompatible_it = node->_incompatible_peers.find(peer);
+                auto uuid_it = node->_connected_peers.find(peer);
+                if (incompatible_it != node->_incompatible_peers.end() && (!szUuid || incompatible_it->second == szUuid)) {
+                    // never made it into the directory, so there's nothing else to clean up
+                    node->_incompatible_peers.erase(incompatible_it);
+                } else if (uuid_it == node->_connected_peers.end() || !szUuid || uuid_it->second == szUuid) {
+                    if (uuid_it != node->_connected_peers.end())
+                        node->_connected_peers.erase(uuid_it);
+
+                    node->remove_memberships(peer);
+                    node->_directory_changed = true;
+
+                    for (auto& group : node->_subscribers.keys()) {
+                        node->unsubscribe(group, name);
                     }
-                });
-
-                for (auto it = new_groups.begin(); it != new_groups.end(); ++it) {
-                    node->_peer_groups.upsert(it->first, it->second);
                 }
 
                 //DebugSpewAlways("%s is EXITing.", name.c_str());
+            } else if (node->_incompatible_peers.find(peer) != node->_incompatible_peers.end()) {
+                // on another protocol version, so its groups and commands are dropped here
             } else if (event_type == "JOIN") {
                 std::string group = init_string(zyre_event_group(z_event));
 
@@ -1247,9 +1982,8 @@ void Node::node_actor(zsock_t* pipe, void* args) {
                         return f(name, group);
                     });
 
-                    node->_peer_groups.upsert(group, [&name](std::set<std::string>& group) -> void {
-                        group.emplace(name);
-                    });
+                    node->add_membership(node->_symbols.intern(group), peer);
+                    node->_directory_changed = true;
                     //DebugSpewAlways("JOIN %s : %s", group.c_str(), name.c_str());
                 }
             } else if (event_type == "LEAVE") {
@@ -1261,10 +1995,8 @@ void Node::node_actor(zsock_t* pipe, void* args) {
                     node->_leave_callbacks.remove_if([&name, &group](std::function<bool(const std::string&, const std::string&)> f) -> bool {
                         return f(name, group);
                     });
-                    node->_peer_groups.erase_if(group, [&name, &node](std::set<std::string>& group) -> bool {
-                        group.erase(name);
-                        return group.empty();
-                    });
+                    node->remove_membership(node->_symbols.find(group), peer);
+                    node->_directory_changed = true;
                     //DebugSpewAlways("LEAVE %s : %s", group.c_str(), name.c_str());
                 }
             } else if (event_type == "WHISPER") {
@@ -1273,8 +2005,7 @@ void Node::node_actor(zsock_t* pipe, void* args) {
                 if (!message) {
                     DebugSpewAlways("MQ2DanNet: Got NULL WHISPER message from %s", name.c_str());
                 } else {
-                    zmsg_addstr(message, name.c_str());
-                    zmsg_send(&message, node->_actor);
+                    node->queue_message(name, std::string(), &message);
                 }
             } else if (event_type == "SHOUT") {
                 // this presumes that group will return NULL if not a shot, which is valid in zyre if we don't set ZYRE_DEBUG or ZYRE_PEDANTIC
@@ -1288,10 +2019,7 @@ void Node::node_actor(zsock_t* pipe, void* args) {
                     if (!message) {
                         DebugSpewAlways("MQ2DanNet: Got NULL SHOUT message from %s in %s", name.c_str(), group.c_str());
                     } else {
-                        // note that this goes to the end of the message
-                        zmsg_addstr(message, name.c_str());
-                        zmsg_addstr(message, group.c_str());
-                        zmsg_send(&message, node->_actor);
+                        node->queue_message(name, group, &message);
                     }
                 }
             } else if (event_type == "EVASIVE") {
@@ -1334,6 +2062,10 @@ void Node::node_actor(zsock_t* pipe, void* args) {
         zlist_destroy(&own_groups);
     }
     node->_own_groups.clear();
+    node->_connected_peers.clear();
+    node->_peer_groups.clear();
+    node->_memberships.clear();
+    node->publish_directory();
 
     zyre_stop(node->_node);
     zclock_sleep(100);
@@ -1352,16 +2084,33 @@ std::string Node::init_string(const char* szStr) {
     return std::string();
 }
 
-MQ2DANNET_NODE_API std::string MQ2DanNet::Node::register_response(std::function<bool(std::stringstream&&)> callback) {
-    // C99, 6.2.5p9 -- guarantees that this will wrap to 0 once we reach max value
-    unsigned char next_val = _response_keys.get_next([](unsigned char key) -> unsigned char {
-        return key + 1;
-    });
-    _response_keys.insert(next_val);
-    std::string key = "response_" + std::to_string((unsigned int)next_val);
+MQ2DANNET_NODE_API void MQ2DanNet::Node::register_command(uint32_t id, const std::string& name, std::function<bool(Reader&&)> callback) {
+    if (!_command_table.insert(id, name, std::move(callback)))
+        DebugSpewAlways("MQ2DanNet: Could not register %s, its id %08x is taken.", name.c_str(), id);
+}
+
+MQ2DANNET_NODE_API uint32_t MQ2DanNet::Node::register_response(std::function<bool(Reader&&)> callback) {
+    // a peer that hasn't answered by the time it would be considered gone isn't going to
+    unsigned __int64 deadline = MQGetTickCount64() + (_expired > 0 ? _expired : 30000);
+
+    uint32_t id = _pending.insert(callback, deadline);
+    while (id != 0 && _command_table.contains(id)) {
+        // responses share the wire with command ids, so skip any request id that happens to hash like a command
+        uint32_t next = _pending.insert(callback, deadline);
+        _pending.erase(id);
+        id = next;
+    }
 
-    register_command(key, callback);
-    return key;
+    if (id == 0)
+        DebugSpewAlways("MQ2DanNet: Too many outstanding requests, the response will be dropped.");
+
+    return id;
+}
+
+void MQ2DanNet::Node::expire_responses() {
+    std::size_t expired = _pending.expire(MQGetTickCount64());
+    if (expired > 0)
+        DebugSpewAlways("MQ2DanNet: %u requests expired without a response.", static_cast<unsigned int>(expired));
 }
 
 // this is pretty much fire and forget. We could potentially have a bunch of vacant observers, but don't worry about that, let's just test it.
@@ -1369,103 +2118,176 @@ MQ2DANNET_NODE_API std::string MQ2DanNet::Node::register_response(std::function<
 // potentially on_join if no group is available, have the client re-register?
 MQ2DANNET_NODE_API std::string MQ2DanNet::Node::register_observer(const std::string& name, const std::string& query) {
     // first search for the key in the map already
-    for (auto observer : _observer_map.copy()) {
-        if (observer.second.query == query)
-            return observer_group(observer.first);
+    symbol id = _symbols.intern(query);
+    unsigned int key;
+    Query observer;
+    if (_observer_keys.find(id, key) && _observer_map.find(key, observer)) {
+        std::string group = observer_group(key);
+        bool idle = false;
+        _subscribers.upsert(group, [&name, &idle](std::set<std::string>& subscribers) {
+            idle = subscribers.empty();
+            subscribers.emplace(name);
+        });
+
+        // an observer nobody was subscribed to has backed off to the slowest cadence, so don't make the new subscriber
+        // wait out that interval before it sees anything
+        if (idle) {
+            observer.interval = 0;
+            schedule_observer(key, observer, MQGetTickCount64() + observe_jitter(observe_delay()));
+        }
+
+        ++_observer_version;
+        return group;
     }
 
     // didn't find anything, insert a new one
-    Query obs(query);
+    Query obs(query, id);
 
-    unsigned int position = _observer_map.upsert_wrap(std::move(obs), [](unsigned int p) -> unsigned int {
+    unsigned int position = _observer_map.upsert_wrap(obs, [](unsigned int p) -> unsigned int {
         return p + 1;
     });
 
-    return observer_group(position);
+    _observer_keys.upsert(id, position);
+
+    // start at a random phase across the delay so a batch of new observers doesn't all fire on the same pulse
+    schedule_observer(position, obs, MQGetTickCount64() + observe_jitter(observe_delay()));
+
+    std::string group = observer_group(position);
+    _subscribers.upsert(group, std::set<std::string>{ name });
+    ++_observer_version;
+    return group;
 }
 
 MQ2DANNET_NODE_API void MQ2DanNet::Node::unregister_observer(const std::string& query) {
-    _observer_map.erase_if([&query](std::pair<unsigned int, Query> p) -> bool {
-        return p.second.query == query;
-    });
+    unsigned int key;
+    symbol id = _symbols.find(query);
+    if (id == 0 || !_observer_keys.find(id, key))
+        return;
+
+    _subscribers.erase(observer_group(key));
+    _observer_map.erase(key);
+    _observer_keys.erase(id);
+    _query_map.erase(id);
+    ++_observer_version;
 }
 
+// observer groups are just keys now, nobody joins them -- the observed peer keeps track of who to send updates to
 MQ2DANNET_NODE_API void MQ2DanNet::Node::observe(const std::string& group, const std::string& name, const std::string& query) {
-    join(group);
-    _observed_map.upsert(Observed(query, name), group);
+    _observed.insert(Observed(_symbols.intern(query), _symbols.intern(name)), group);
+    ++_observer_version;
 }
 
 MQ2DANNET_NODE_API void MQ2DanNet::Node::forget(const std::string& group) {
-    _observed_map.erase_if([&group](auto p) -> bool {
-        return p.second == group;
-    });
-
-    _observed_data.erase(group);
-
-    leave(group);
+    Observed observed;
+    if (_observed.erase(group, observed)) {
+        ++_observer_version;
+        whisper<Forget>(_symbols.name(observed.name), group);
+    }
 }
 
 MQ2DANNET_NODE_API void MQ2DanNet::Node::forget(const std::string& name, const std::string& query) {
-    Observed observed = Observed(query, name);
-    _observed_map.foreach ([this, observed](std::pair<Observed, std::string> pair) -> void {
-        if (pair.first.query == observed.query && pair.first.name == observed.name) {
-            _observed_data.erase(pair.second);
-            leave(pair.second);
-        }
-    });
-    _observed_map.erase(observed);
+    std::string group;
+    if (_observed.erase(Observed(_symbols.find(query), _symbols.find(name)), group)) {
+        ++_observer_version;
+        whisper<Forget>(name, group);
+    }
 }
 
 MQ2DANNET_NODE_API void MQ2DanNet::Node::forget_all(const std::string& name) {
-    std::list<Observed> to_drop;
-    _observed_map.foreach ([this, &name, &to_drop](std::pair<Observed, std::string> pair) -> void {
-        if (pair.first.name == name) {
-            _observed_data.erase(pair.second);
-            leave(pair.second);
-            to_drop.push_back(pair.first);
-        }
+    symbol peer = _symbols.find(name);
+    std::list<std::pair<Observed, std::string>> to_drop;
+    _observed.foreach ([peer, &to_drop](const Observed& key, const std::string& group, const Observation&) -> void {
+        if (key.name == peer)
+            to_drop.emplace_back(key, group);
     });
 
-    for (auto drop : to_drop) {
-        _observed_map.erase(drop);
+    if (!to_drop.empty())
+        ++_observer_version;
+
+    for (auto& drop : to_drop) {
+        std::string group;
+        _observed.erase(drop.first, group);
+        whisper<Forget>(name, drop.second);
     }
 }
 
-MQ2DANNET_NODE_API void MQ2DanNet::Node::update(const std::string& group, const std::string& data, const std::string& output) {
-    _observed_data.upsert(group, Observation(output, data, MQGetTickCount64()));
+// the observer sticks around even without subscribers (its cadence backs off), so a new subscriber gets the same group
+MQ2DANNET_NODE_API void MQ2DanNet::Node::unsubscribe(const std::string& group, const std::string& name) {
+    _subscribers.erase_if(group, [&name](std::set<std::string>& subscribers) -> bool {
+        subscribers.erase(name);
+        return false;
+    });
+    ++_observer_version;
+}
+
+// an update for a group we aren't observing (anymore) has nowhere to go, so it's dropped
+MQ2DANNET_NODE_API void MQ2DanNet::Node::update(const std::string& group, const Value& data, const std::string& output) {
+    Observation* observation = _observed.find(group);
+    if (observation) {
+        if (&observation->output != &output)
+            observation->output = output;
+        observation->data = data;
+        observation->received = MQGetTickCount64();
+    }
 }
 
 MQ2DANNET_NODE_API const Node::Observation MQ2DanNet::Node::read(const std::string& group) {
-    return _observed_data.get(group);
+    const Observation* observation = observed(group);
+    return observation ? *observation : Observation();
 }
 
 MQ2DANNET_NODE_API const Node::Observation MQ2DanNet::Node::read(const std::string& name, const std::string& query) {
-    // this is safe because these get return default constructed objects if they aren't found
-    return _observed_data.get(_observed_map.get(Observed(query, name)));
+    const Observation* observation = observed(name, query);
+    return observation ? *observation : Observation();
+}
+
+MQ2DANNET_NODE_API const Node::Observation* MQ2DanNet::Node::observed(const std::string& group) {
+    return _observed.find(group);
+}
+
+MQ2DANNET_NODE_API const Node::Observation* MQ2DanNet::Node::observed(const std::string& name, const std::string& query) {
+    return _observed.find(Observed(_symbols.find(query), _symbols.find(name)));
+}
+
+MQ2DANNET_NODE_API const Node::Observation* MQ2DanNet::Node::observed(const std::string& name, const char* query) {
+    auto it = _observed_spellings.find(std::make_pair(&name, query));
+    if (it != _observed_spellings.end())
+        return _observed.find(it->second);
+
+    Observed key(_symbols.find(trim_query(query)), _symbols.find(name));
+    // nothing's been interned for one of these yet, so don't remember it -- it might be by the next time we're asked
+    if (key.query == 0 || key.name == 0)
+        return nullptr;
+
+    if (_observed_spellings.size() >= max_observed_spellings)
+        _observed_spellings.clear();
+
+    _observed_spellings.emplace(std::make_pair(name, std::string(query)), key);
+    return _observed.find(key);
 }
 
 MQ2DANNET_NODE_API bool MQ2DanNet::Node::can_read(const std::string& name, const std::string& query) {
-    return _observed_map.contains(Observed(query, name));
+    return observed(name, query) != nullptr;
 }
 
 MQ2DANNET_NODE_API size_t MQ2DanNet::Node::observed_count(const std::string& name) {
-    std::set<Observed, ObservedCompare> keys = _observed_map.keys();
-    std::list<Observed> observed;
-    std::copy_if(keys.cbegin(), keys.cend(), std::inserter(observed, observed.begin()),
-        [&name](const Observed& obs) { return obs.name == name; });
+    symbol peer = _symbols.find(name);
+    size_t count = 0;
+    _observed.foreach ([peer, &count](const Observed& key, const std::string&, const Observation&) -> void {
+        if (key.name == peer)
+            ++count;
+    });
 
-    return observed.size();
+    return count;
 }
 
 MQ2DANNET_NODE_API std::set<std::string> MQ2DanNet::Node::observed_queries(const std::string& name) {
-    std::set<Observed, ObservedCompare> keys = _observed_map.keys();
-    std::set<Observed, ObservedCompare> observed;
-    std::copy_if(keys.cbegin(), keys.cend(), std::inserter(observed, observed.begin()),
-        [&name](const Observed& obs) { return obs.name == name; });
-
+    symbol peer = _symbols.find(name);
     std::set<std::string> queries;
-    std::transform(observed.cbegin(), observed.cend(), std::inserter(queries, queries.begin()),
-        [](const Observed& obs) { return obs.query; });
+    _observed.foreach ([this, peer, &queries](const Observed& key, const std::string&, const Observation&) -> void {
+        if (key.name == peer)
+            queries.emplace(_symbols.name(key.query));
+    });
 
     return queries;
 }
@@ -1484,93 +2306,325 @@ MQ2DANNET_NODE_API std::set<std::string> MQ2DanNet::Node::observer_queries() {
 }
 
 MQ2DANNET_NODE_API std::set<std::string> MQ2DanNet::Node::observers(const std::string& query) {
-    for (auto observer : _observer_map.copy()) {
-        if (observer.second.query == query) {
-            return get_group_peers(Node::get().observer_group(observer.first));
-        }
-    }
+    unsigned int key;
+    symbol id = _symbols.find(query);
+    if (id == 0 || !_observer_keys.find(id, key))
+        return std::set<std::string>();
 
-    return std::set<std::string>();
+    return _subscribers.get(observer_group(key));
+}
+
+MQ2DANNET_NODE_API bool MQ2DanNet::Node::observer_rate(const std::string& query, ObserverRate& rate) {
+    unsigned int key;
+    Query observer;
+    symbol id = _symbols.find(query);
+    if (id == 0 || !_observer_keys.find(id, key) || !_observer_map.find(key, observer))
+        return false;
+
+    rate.subscribers = 0;
+    _subscribers.visit(observer_group(key), [&rate](const std::set<std::string>& names) { rate.subscribers = static_cast<unsigned int>(names.size()); });
+    rate.interval = static_cast<unsigned int>(observer.interval != 0 ? observer.interval : observe_interval(observer, rate.subscribers));
+    rate.cost = static_cast<unsigned int>(observer.cost);
+    rate.churn = static_cast<unsigned int>(100.0 * observer.churn + 0.5);
+    return true;
 }
 
 // stub these for now, nothing to do here since memory is managed elsewhere (and all registered commands will go away)
-Node::Node() {}
-Node::~Node() {}
+Node::Node() : _directory(new Directory()), _quiescent_version(0), _directory_changed(false), _deferred_events(0), _pulse_period(0), _last_publish(0), _observer_version(0), _last_query_id(0), _query_max_age(0), _query_cache_hits(0), _query_cache_misses(0), _last_query_handle(0), _group_query_id(0) {}
+Node::~Node() {
+    delete _directory.load();
+    for (auto retired : _retired_directories)
+        delete retired;
+}
+
+unsigned int MQ2DanNet::Node::query_handle(const std::string& output) {
+    // 0 is never a handle so that it can't be confused with an unset index
+    if (++_last_query_handle == 0)
+        ++_last_query_handle;
+
+    _query_results.upsert(_last_query_handle, Observation(output));
+    _query_results.erase(_last_query_handle - max_query_results);
+
+    return _last_query_handle;
+}
+
+bool MQ2DanNet::Node::query(unsigned int handle, Observation& obs) {
+    return _query_results.find(handle, obs);
+}
+
+Node::Observation MQ2DanNet::Node::query() {
+    return _query_results.get(_last_query_handle);
+}
+
+void MQ2DanNet::Node::query_result(unsigned int handle, const Observation& obs) {
+    // a handle that has already been dropped stays dropped
+    if (_query_results.contains(handle))
+        _query_results.upsert(handle, obs);
+}
+
+bool MQ2DanNet::Node::group_query(const std::string& group, const std::string& query) {
+    _group_query_peers = get_group_peers(group);
+    _group_query_results.clear();
+    unsigned int query_id = ++_group_query_id;
+
+    if (_group_query_peers.empty())
+        return false;
+
+    // we never hear our own shout, so answer for ourselves here
+    if (_group_query_peers.find(_node_name) != _group_query_peers.end())
+        _group_query_results.upsert(_node_name, Observation(std::string(), parse_value(query), MQGetTickCount64()));
+
+    if (group_query_pending() == 0)
+        return true;
+
+    // every peer answers the same request id, so the response stays registered until the last one is in
+    auto f = [query_id, query](Reader&& args) -> bool {
+        Value data;
+
+        try {
+            args >> data;
+        } catch (std::runtime_error&) {
+            DebugSpewAlways("MQ2DanNet::GroupQuery -- response -- Failed to deserialize.");
+            return false;
+        }
+
+        Node& node = Node::get();
+        if (query_id != node._group_query_id)
+            return true; // a newer group query replaced this one
+
+        Observation result(std::string(), data, MQGetTickCount64());
+        node.cache_query(args.from(), query, result);
+        if (node._group_query_peers.find(args.from()) != node._group_query_peers.end())
+            node._group_query_results.upsert(args.from(), result);
+
+        return node.group_query_pending() == 0;
+    };
+
+    Buffer send_buffer;
+    Archive<Buffer> send(send_buffer);
+    send << register_response(f) << query;
+    publish(group, id<MQ2DanNet::Query>(), std::move(send_buffer));
+
+    return true;
+}
+
+bool MQ2DanNet::Node::group_query(const std::string& peer, Observation& obs) {
+    return _group_query_results.find(peer, obs);
+}
+
+std::size_t MQ2DanNet::Node::group_query_pending() {
+    return _group_query_peers.size() - _group_query_results.size();
+}
+
+// a macro looping /dquery over changing arguments would grow this forever, so once it's full whatever is too old for
+// /dquery to use goes, and if that doesn't make room it starts over
+void MQ2DanNet::Node::cache_query(const std::string& name, const std::string& query, const Observation& obs) {
+    if (_query_cache.size() >= max_cached_queries) {
+        unsigned __int64 now = MQGetTickCount64();
+        unsigned __int64 max_age = _query_max_age;
+        _query_cache.erase_if([now, max_age](std::pair<std::pair<std::string, std::string>, Observation> cached) -> bool {
+            return now - cached.second.received > max_age;
+        });
 
-Node::Observation MQ2DanNet::Node::query(const std::string& output, const std::string& query) {
+        if (_query_cache.size() >= max_cached_queries)
+            _query_cache.clear();
+    }
+
+    _query_cache.upsert(std::make_pair(name, trim_query(query)), obs);
+}
+
+bool MQ2DanNet::Node::cached_query(const std::string& name, const std::string& query, unsigned __int64 max_age, Observation& obs) {
     std::string final_query = trim_query(query);
 
-    if (final_query.empty() || final_query != _current_query) {
-        _current_query = final_query;
-        _query_result = Observation(output);
+    Observation cached = _query_cache.get(std::make_pair(name, final_query));
+    if (can_read(name, final_query)) {
+        Observation observed = read(name, final_query);
+        if (observed.received > cached.received)
+            cached = observed;
     }
 
-    return _query_result;
+    if (cached.received == 0 || MQGetTickCount64() - cached.received > max_age) {
+        ++_query_cache_misses;
+        return false;
+    }
+
+    ++_query_cache_hits;
+    obs = cached;
+    return true;
 }
 
-Node::Observation MQ2DanNet::Node::query() {
-    return _query_result;
+std::size_t MQ2DanNet::Node::query_pending() {
+    return std::count_if(_query_batch.cbegin(), _query_batch.cend(), [this](unsigned int handle) {
+        Observation obs;
+        return _query_results.find(handle, obs) && obs.received == 0;
+    });
 }
 
-void MQ2DanNet::Node::query_result(const Observation& obs) {
-    _query_result = obs;
+std::string MQ2DanNet::Node::unescape(const std::string& text) {
+    std::string r;
+    r.reserve(text.size());
+    for (std::size_t i = 0; i < text.size(); ++i) {
+        if (text[i] == '$' && text.compare(i + 1, 2, "\\{") == 0) {
+            r += "${";
+            i += 2;
+        } else {
+            r += text[i];
+        }
+    }
+
+    return r;
 }
 
-std::string MQ2DanNet::Node::trim_query(const std::string& query) {
-    std::string final_query = std::regex_replace(query, std::regex("\\$\\\\\\{"), "${");
+std::string MQ2DanNet::Node::canonical_query(const std::string& query) {
+    std::string r = unescape(query);
 
-    if (final_query.front() == '"')
-        final_query.erase(final_query.begin(), final_query.begin() + 1);
+    auto trim = [&r]() {
+        std::string::size_type first = r.find_first_not_of(" \t");
+        if (first == std::string::npos) {
+            r.clear();
+        } else {
+            r.erase(r.find_last_not_of(" \t") + 1);
+            r.erase(0, first);
+        }
+    };
+
+    trim();
+
+    if (!r.empty() && r.front() == '"')
+        r.erase(0, 1);
+
+    if (!r.empty() && r.back() == '"')
+        r.pop_back();
+
+    trim();
+
+    // the wrapper goes back on when it's parsed, so this is safe even for things like ${a}${b}
+    if (r.compare(0, 2, "${") == 0)
+        r.erase(0, 2);
 
-    if (final_query.back() == '"')
-        final_query.erase(final_query.end() - 1);
+    if (!r.empty() && r.back() == '}')
+        r.pop_back();
 
-    if (final_query.find_first_of("${") == 0)
-        final_query.erase(final_query.begin(), final_query.begin() + 2);
+    return r;
+}
+
+std::shared_ptr<const Node::CompiledQuery> MQ2DanNet::Node::compile_query(const std::string& query) {
+    auto compiled_it = _compiled_queries.find(query);
+    if (compiled_it != _compiled_queries.end())
+        return compiled_it->second;
 
-    if (final_query.back() == '}')
-        final_query.erase(final_query.end() - 1);
+    if (_compiled_queries.size() >= max_compiled_queries)
+        _compiled_queries.clear();
 
-    return final_query;
+    // two spellings of the same query share an entry (and an id), the canonical form always maps to itself
+    std::string canonical = canonical_query(query);
+    std::shared_ptr<const CompiledQuery> compiled;
+    compiled_it = _compiled_queries.find(canonical);
+    if (compiled_it != _compiled_queries.end()) {
+        compiled = compiled_it->second;
+    } else {
+        auto created = std::make_shared<CompiledQuery>();
+        created->id = ++_last_query_id;
+        created->query = canonical;
+        created->wrapped = "${" + canonical + "}";
+        created->nested = canonical.find("${") != std::string::npos;
+        compiled = created;
+        _compiled_queries.emplace(canonical, compiled);
+    }
+
+    _compiled_queries.emplace(query, compiled);
+    return compiled;
 }
 
 std::string MQ2DanNet::Node::parse_query(const std::string& query) {
     CHAR szQuery[MAX_STRING];
-    strcpy_s(szQuery, ("${" + query + "}").c_str());
+    strcpy_s(szQuery, compile_query(query)->wrapped.c_str());
 
     ParseMacroData(szQuery, MAX_STRING);
     return szQuery;
 }
 
-MQ2TYPEVAR MQ2DanNet::Node::parse_response(const std::string& output, const std::string& data) {
-    // we need to pass a string data into here because we need to make sure that the output type can handle
-    // the data we give it, which is handled in `FromString`, and if we aren't in a macro we are just going
-    // to write it out anyway.
+Node::Value MQ2DanNet::Node::serve_value(const CompiledQuery& query) {
+    auto memo = _parse_memo.find(query.id);
+    if (memo != _parse_memo.end())
+        return memo->second;
+
+    Value value = parse_value(query);
+    _parse_memo.emplace(query.id, value);
+    return value;
+}
+
+Node::Value MQ2DanNet::Node::parse_value(const CompiledQuery& query) {
+    CHAR szQuery[MAX_STRING] = { 0 };
+
+    // nested expressions have to go through the full parser, which only gives us back a string
+    if (query.nested) {
+        strcpy_s(szQuery, query.wrapped.c_str());
+        ParseMacroData(szQuery, MAX_STRING);
+        return Value(szQuery);
+    }
+
+    strcpy_s(szQuery, query.query.c_str());
+
+    MQ2TYPEVAR Result;
+    Result.Type = 0;
+    Result.Int64 = 0;
+    if (!ParseMQ2DataPortion(szQuery, Result) || !Result.Type)
+        return Value();
+
+    if (Result.Type == pIntType)
+        return Value(Value::Int, Result.Int);
+    if (Result.Type == pInt64Type)
+        return Value(Value::Int64, Result.Int64);
+    if (Result.Type == pBoolType)
+        return Value(Value::Bool, Result.DWord != 0);
+
+    if (Result.Type == pFloatType) {
+        Value value(Value::Float, 0);
+        value.real = Result.Float;
+        return value;
+    }
+
+    CHAR szBuf[MAX_STRING] = { 0 };
+    Result.Type->ToString(Result.VarPtr, szBuf);
+
+    if (Result.Type == pSpawnType && Result.Ptr) {
+        Value value(Value::Spawn, reinterpret_cast<PSPAWNINFO>(Result.Ptr)->SpawnID);
+        value.text = szBuf;
+        return value;
+    }
+
+    return Value(szBuf);
+}
+
+MQ2TYPEVAR MQ2DanNet::Node::parse_response(const std::string& output, const Value& data) {
+    // typed data goes straight into an output variable of the same type, anything else has to go through `FromString`
+    // so that the output type can decide if it can handle the data we give it. If we aren't in a macro we are just
+    // going to write it out anyway.
 
     if (!output.empty() && gMacroBlock) { // let's make sure a macro is running here
         CHAR szOutput[MAX_STRING] = { 0 };
         strcpy_s(szOutput, output.c_str());
         PDATAVAR pVar = FindMQ2DataVariable(szOutput);
         if (pVar) {
-            CHAR szData[MAX_STRING] = { 0 };
-            strcpy_s(szData, data.c_str());
-            if (!pVar->Var.Type->FromString(pVar->Var.VarPtr, szData)) {
-                MacroError("/dquery: setting '%s' failed, variable type rejected new value of %s", szOutput, szData);
+            MQ2TYPEVAR Source = data.type_var();
+            if (Source.Type != pVar->Var.Type || !pVar->Var.Type->FromData(pVar->Var.VarPtr, Source)) {
+                CHAR szData[MAX_STRING] = { 0 };
+                data.to_string(szData);
+                if (!pVar->Var.Type->FromString(pVar->Var.VarPtr, szData)) {
+                    MacroError("/dquery: setting '%s' failed, variable type rejected new value of %s", szOutput, szData);
+                }
             }
 
-            if (pVar)
-                return pVar->Var;
+            return pVar->Var;
         } else {
             MacroError("/dquery failed, variable '%s' not found", szOutput);
         }
     } else {
-        // if we aren't in a macro or we have no output, we are dealing with a string
-        MQ2TYPEVAR Result;
-        strcpy_s(DataTypeTemp, data.c_str());
-        Result.Ptr = &DataTypeTemp[0];
-        Result.Type = pStringType;
+        // if we aren't in a macro or we have no output, just hand back the data as it is
+        MQ2TYPEVAR Result = data.type_var();
         if (debugging())
-            WriteChatf("%s", data.c_str());
+            WriteChatf("%s", data.to_string().c_str());
 
         return Result;
     }
@@ -1581,8 +2635,89 @@ MQ2TYPEVAR MQ2DanNet::Node::parse_response(const std::string& output, const std:
     return Result;
 }
 
+const char* MQ2DanNet::Node::Value::type_name() const {
+    switch (kind) {
+    case Int:
+        return "int";
+    case Int64:
+        return "int64";
+    case Float:
+        return "float";
+    case Bool:
+        return "bool";
+    case Spawn:
+        return "spawn";
+    default:
+        return "string";
+    }
+}
+
+MQ2TYPEVAR MQ2DanNet::Node::Value::type_var() const {
+    MQ2TYPEVAR Result;
+    Result.Int64 = 0;
+
+    switch (kind) {
+    case Int:
+        Result.Int = static_cast<int>(number);
+        Result.Type = pIntType;
+        return Result;
+    case Int64:
+        Result.Int64 = number;
+        Result.Type = pInt64Type;
+        return Result;
+    case Float:
+        Result.Float = real;
+        Result.Type = pFloatType;
+        return Result;
+    case Bool:
+        Result.DWord = number != 0;
+        Result.Type = pBoolType;
+        return Result;
+    case Spawn: {
+        // spawn ids are only unique within a zone, so only hand out the spawn if it's the same one
+        PSPAWNINFO pSpawn = GetSpawnByID(static_cast<DWORD>(number));
+        if (pSpawn && text == pSpawn->Name) {
+            Result.Ptr = pSpawn;
+            Result.Type = pSpawnType;
+            return Result;
+        }
+        break;
+    }
+    default:
+        break;
+    }
+
+    strcpy_s(DataTypeTemp, text.c_str());
+    Result.Ptr = &DataTypeTemp[0];
+    Result.Type = pStringType;
+    return Result;
+}
+
+void MQ2DanNet::Node::Value::to_string(char* Destination) const {
+    if (kind == String || kind == Spawn) {
+        strcpy_s(Destination, MAX_STRING, text.c_str());
+        return;
+    }
+
+    // let MQ2 format it so it reads exactly like the ParseMacroData string used to
+    MQ2TYPEVAR Result = type_var();
+    if (!Result.Type->ToString(Result.VarPtr, Destination))
+        strcpy_s(Destination, MAX_STRING, "NULL");
+}
+
+std::string MQ2DanNet::Node::Value::to_string() const {
+    if (kind == String || kind == Spawn)
+        return text;
+
+    CHAR szBuf[MAX_STRING] = { 0 };
+    to_string(szBuf);
+    return szBuf;
+}
+
 std::string MQ2DanNet::Node::peer_address(const std::string& name) {
-    return _connected_peers.get(name);
+    const Directory& current = directory();
+    auto uuid_it = current.uuids.find(name);
+    return uuid_it != current.uuids.end() ? uuid_it->second : std::string();
 }
 
 void MQ2DanNet::Node::save_channels() {
@@ -1670,47 +2805,150 @@ void MQ2DanNet::Node::recv() {
                 zsock_signal(_actor, 0);
         }
     }
-}
+}
+
+void Node::queue_command(uint32_t command, const std::string& from, const std::string& group, zframe_t** body) {
+    // defer the actual lookup to the execution so we can handle commands that remove themselves
+    Message queued(command, from, group, body);
+
+    // observer updates only matter for their newest value, so they overwrite each other here instead of piling up in the queue
+    if (command == id<Update>()) {
+        _update_mailbox.put(std::make_pair(from, group), queued);
+        return;
+    }
+
+    // batches are split into one Update per observer group here, so they coalesce with everything else from the same sender
+    if (command == id<UpdateBatch>()) {
+        std::map<std::string, Value> results;
+
+        try {
+            Reader reader = queued.reader();
+            std::tie(results) = UpdateBatch::unpack(reader);
+        } catch (std::runtime_error&) {
+            DebugSpewAlways("MQ2DanNet::UpdateBatch -- Failed to deserialize.");
+            return;
+        }
+
+        for (auto& result : results) {
+            Message update(id<Update>(), from, result.first, pack<Update>(result.first, result.second));
+            update.queued = queued.queued;
+            _update_mailbox.put(std::make_pair(from, result.first), update);
+        }
+
+        return;
+    }
+
+    if (!_command_queue.push(queued))
+        DebugSpewAlways("MQ2DanNet: command queue is full, dropping %s.", command_name(command).c_str());
+}
+
+const std::string MQ2DanNet::Node::observer_group(const unsigned int key) {
+    return _node_name + "_" + init_string(std::to_string(key).c_str());
+}
+
+void Node::queue_message(const std::string& from, const std::string& group, zmsg_t** message) {
+    zframe_t* command = zmsg_pop(*message);
+    zframe_t* body = zmsg_pop(*message);
+
+    if (command && body && zframe_size(command) == sizeof(uint32_t)) {
+        const byte* id = zframe_data(command);
+        queue_command(static_cast<uint32_t>(id[0]) << 24 | static_cast<uint32_t>(id[1]) << 16 | static_cast<uint32_t>(id[2]) << 8 | id[3], from, group, &body);
+    } else {
+        DebugSpewAlways("MQ2DanNet: Malformed message from %s in %s.", from.c_str(), group.c_str());
+    }
+
+    if (body)
+        zframe_destroy(&body);
+    if (command)
+        zframe_destroy(&command);
+    zmsg_destroy(message);
+}
+
+void Node::do_next() {
+    using namespace std::chrono;
+
+    const auto start = steady_clock::now();
+    const auto budget = microseconds(_pulse_budget);
+    PulseStats stats = { 0, 0, 0 };
+
+    auto dispatch = [this, &stats](Message& command) {
+        unsigned __int64 waited = duration_cast<microseconds>(steady_clock::now() - command.queued).count();
+        stats.oldest = std::max<unsigned __int64>(stats.oldest, waited);
+
+        if (!_pending.complete(command.id, command.reader()))
+            _command_table.dispatch(command.id, command.reader());
+        ++stats.drained;
+    };
+
+    // observer updates first, at most one per observer. Whatever doesn't fit in the budget goes back unless it's been superseded
+    auto updates = _update_mailbox.take();
+    auto update_it = updates.begin();
+    for (; update_it != updates.end(); ++update_it) {
+        dispatch(update_it->second);
+
+        if (steady_clock::now() - start >= budget) {
+            ++update_it;
+            break;
+        }
+    }
+
+    for (; update_it != updates.end(); ++update_it)
+        _update_mailbox.restore(update_it->first, update_it->second);
+
+    // always dispatch at least one command so that a budget of 0 still makes progress
+    Message command;
+    while (_command_queue.try_pop(command)) {
+        dispatch(command);
+
+        if (steady_clock::now() - start >= budget)
+            break;
+    }
 
-void Node::queue_command(const std::string& command, std::stringstream&& args) {
-    // defer the actual lookup to the execution so we can handle commands that remove themselves
-    _command_queue.emplace(std::make_pair(command, std::move(args)));
+    stats.deferred = static_cast<unsigned int>(_command_queue.size() + _update_mailbox.size());
+    _pulse_stats = stats;
 }
 
-const std::string MQ2DanNet::Node::observer_group(const unsigned int key) {
-    return _node_name + "_" + init_string(std::to_string(key).c_str());
-}
+// a peer that (re)entered has no idea we were subscribed to it, so observe everything we have on it again. The observed
+// peer hands back the same group for a query it already has, so this only puts us back in its subscriber list
+void Node::resubscribe() {
+    std::set<std::string> entered = _entered_peers.take();
+    if (entered.empty())
+        return;
 
-void Node::do_next() {
-    std::pair<std::string, std::stringstream> command_pair = _command_queue.pop();
-    _command_map.erase_if(command_pair.first, [&command_pair](std::function<bool(std::stringstream &&)> f) -> bool {
-        return f(std::move(command_pair.second));
+    _observed.foreach ([this, &entered](const Observed& key, const std::string&, const Observation& observation) -> void {
+        const std::string& name = _symbols.name(key.name);
+        if (name != _node_name && entered.find(name) != entered.end())
+            whisper<Observe>(name, "${" + _symbols.name(key.query) + "}", observation.output);
     });
 }
 
-void Node::remove_commands(const std::function<bool(std::pair<std::string, std::stringstream>&)>& f) {
-    _command_queue.remove_if(f);
+// the actor can't write to chat, so peers it turned away are reported here
+void Node::report_rejected() {
+    for (auto& rejected : _rejected_peers.take()) {
+        if (rejected.second.empty())
+            WriteChatf("\ax\arMQ2DanNet: %s is running a version of MQ2DanNet from before 0.7538, which doesn't say what protocol it speaks, ignoring it.\ax", get_name(rejected.first).c_str());
+        else
+            WriteChatf("\ax\arMQ2DanNet: %s is running MQ2DanNet protocol %s, this is protocol %u, ignoring it.\ax", get_name(rejected.first).c_str(), rejected.second.c_str(), protocol_version);
+    }
 }
 
 #pragma endregion
 
 #pragma region Commands
 
-const bool MQ2DanNet::Echo::callback(std::stringstream&& args) {
-    Archive<std::stringstream> received(args);
-    std::string from;
-    std::string group;
-    std::string text;
+const bool MQ2DanNet::Echo::callback(Node::Reader&& args) {
+    Node::View text;
 
     try {
-        received >> from >> group >> text;
-        from = Node::get().get_name(from);
-        //DebugSpewAlways("ECHO --> FROM: %s, GROUP: %s, TEXT: %s", from.c_str(), group.c_str(), text.c_str());
+        std::tie(text) = unpack(args);
+        std::string from = Node::get().get_name(args.from());
+        const std::string& group = args.group();
+        //DebugSpewAlways("ECHO --> FROM: %s, GROUP: %s, TEXT: %.*s", from.c_str(), group.c_str(), (int)text.size, text.data);
 
         if (group.empty())
-            WriteChatf("\ax\a-t[\ax\at %s \ax\a-t]\ax \aw%s\ax", from.c_str(), text.c_str());
+            WriteChatf("\ax\a-t[\ax\at %s \ax\a-t]\ax \aw%.*s\ax", from.c_str(), (int)text.size, text.data);
         else
-            WriteChatf("\ax\a-t[\ax\at %s\ax\a-t (%s) ]\ax \aw%s\ax", from.c_str(), group.c_str(), text.c_str());
+            WriteChatf("\ax\a-t[\ax\at %s\ax\a-t (%s) ]\ax \aw%.*s\ax", from.c_str(), group.c_str(), (int)text.size, text.data);
 
         return false;
     } catch (std::runtime_error&) {
@@ -1719,25 +2957,20 @@ const bool MQ2DanNet::Echo::callback(std::stringstream&& args) {
     }
 }
 
-std::stringstream MQ2DanNet::Echo::pack(const std::string& recipient, const std::string& message) {
-    std::stringstream send_stream;
-    Archive<std::stringstream> send(send_stream);
-    send << message;
-
-    return send_stream;
+Node::Buffer MQ2DanNet::Echo::pack(const std::string& recipient, const std::string& message) {
+    return encode(message);
 }
 
-const bool MQ2DanNet::Execute::callback(std::stringstream&& args) {
-    Archive<std::stringstream> received(args);
-    std::string from;
-    std::string group;
+const bool MQ2DanNet::Execute::callback(Node::Reader&& args) {
+    const std::string& from = args.from();
+    const std::string& group = args.group();
     std::string command;
 
     try {
-        received >> from >> group >> command;
+        std::tie(command) = unpack(args);
         //DebugSpewAlways("EXECUTE --> FROM: %s, GROUP: %s, TEXT: %s", from.c_str(), group.c_str(), command.c_str());
 
-        std::string final_command = std::regex_replace(command, std::regex("\\$\\\\\\{"), "${");
+        std::string final_command = Node::unescape(command);
 
         if (Node::get().command_echo()) {
             if (group.empty()) {
@@ -1751,6 +2984,9 @@ const bool MQ2DanNet::Execute::callback(std::stringstream&& args) {
         strcpy_s(szCommand, final_command.c_str());
         EzCommand(szCommand);
 
+        // the command could have changed anything, so nothing evaluated before it is any good now
+        Node::get().clear_parse_memo();
+
         return false;
     } catch (std::runtime_error&) {
         DebugSpewAlways("MQ2DanNet::Echo -- Failed to deserialize.");
@@ -1758,30 +2994,24 @@ const bool MQ2DanNet::Execute::callback(std::stringstream&& args) {
     }
 }
 
-std::stringstream MQ2DanNet::Execute::pack(const std::string& recipient, const std::string& command) {
-    std::stringstream send_stream;
-    Archive<std::stringstream> send(send_stream);
-    send << command;
-
-    return send_stream;
+Node::Buffer MQ2DanNet::Execute::pack(const std::string& recipient, const std::string& command) {
+    return encode(command);
 }
 
-const bool MQ2DanNet::Query::callback(std::stringstream&& args) {
-    Archive<std::stringstream> received(args);
-    std::string from;
-    std::string group; // this is irrelevant, but we need to pull the parameter anyway.
-    std::string key;
+const bool MQ2DanNet::Query::callback(Node::Reader&& args) {
+    const std::string& from = args.from();
+    uint32_t key;
     std::string request;
 
     try {
-        received >> from >> group >> key >> request;
-        //DebugSpewAlways("QUERY --> FROM: %s, GROUP: %s, REQUEST: %s", from.c_str(), group.c_str(), request.c_str());
+        std::tie(key, request) = unpack(args);
+        //DebugSpewAlways("QUERY --> FROM: %s, GROUP: %s, REQUEST: %s", from.c_str(), args.group().c_str(), request.c_str());
 
-        std::stringstream send_stream;
-        Archive<std::stringstream> send(send_stream);
+        Node::Buffer send_buffer;
+        Archive<Node::Buffer> send(send_buffer);
 
-        send << Node::get().parse_query(request);
-        Node::get().respond(from, key, std::move(send_stream));
+        send << Node::get().serve_value(request);
+        Node::get().respond(from, key, std::move(send_buffer));
 
         return false;
     } catch (std::runtime_error&) {
@@ -1791,39 +3021,27 @@ const bool MQ2DanNet::Query::callback(std::stringstream&& args) {
 }
 
 // we're going to generate a new command and register it with Node here in addition to packing
-std::stringstream MQ2DanNet::Query::pack(const std::string& recipient, const std::string& request) {
-    std::stringstream send_stream;
-    Archive<std::stringstream> send(send_stream);
-
-    // now we make a callback for the Query command that sets the variable
-    auto f = [](std::stringstream&& args) -> bool {
-        Archive<std::stringstream> ar(args);
-        std::string from;
-        std::string group;
-        std::string data;
+Node::Buffer MQ2DanNet::Query::pack(const std::string& recipient, const std::string& request, unsigned int handle) {
+    // now we make a callback for the Query command that sets the variable, the handle never leaves this client
+    auto f = [handle, request](Node::Reader&& args) -> bool {
+        Node::Value data;
 
         try {
-            ar >> from >> group >> data;
+            args >> data;
+            Node::get().cache_query(args.from(), request, Node::Observation(std::string(), data, MQGetTickCount64()));
 
-            std::string output = Node::get().query().output;
-            MQ2TYPEVAR Result = Node::get().parse_response(output, data);
+            Node::Observation result;
+            if (!Node::get().query(handle, result))
+                return true; // too old, nobody can read it anymore
+
+            if (!result.output.empty())
+                Node::get().parse_response(result.output, data);
 
             // this actually only determines when the delay breaks.
-            CHAR szBuf[MAX_STRING] = { 0 };
-            if (Result.Type)
-                Result.Type->ToString(Result.VarPtr, szBuf);
-            else
-                strcpy_s(szBuf, "NULL");
-            Node::get().query_result(Node::Observation(output, std::string(szBuf), MQGetTickCount64()));
-
-            if (Node::get().debugging()) {
-                if (Result.Type) {
-                    CHAR szData[MAX_STRING] = { 0 };
-                    Result.Type->ToString(Result.VarPtr, szData);
-                    WriteChatf("%s : %s -- %llu (%llu)", Result.Type->GetName(), szData, Node::get().query().received, MQGetTickCount64());
-                } else
-                    WriteChatf("Failed to read data %s into %s at %llu.", data.c_str(), output.c_str(), MQGetTickCount64());
-            }
+            Node::get().query_result(handle, Node::Observation(result.output, data, MQGetTickCount64()));
+
+            if (Node::get().debugging())
+                WriteChatf("%s : %s -- %u (%llu)", data.type_name(), data.to_string().c_str(), handle, MQGetTickCount64());
         } catch (std::runtime_error&) {
             DebugSpewAlways("MQ2DanNet::Query -- response -- Failed to deserialize.");
         }
@@ -1831,31 +3049,27 @@ std::stringstream MQ2DanNet::Query::pack(const std::string& recipient, const std
         return true;
     };
 
-    std::string key = Node::get().register_response(f);
-    send << key << request;
-
-    return send_stream;
+    uint32_t key = Node::get().register_response(f);
+    return encode(key, request);
 }
 
 // this is the callback for the observable, so add to map and send back the result group to the requester
-const bool MQ2DanNet::Observe::callback(std::stringstream&& args) {
-    Archive<std::stringstream> received(args);
-    std::string from;
-    std::string group;
-    std::string key;
+const bool MQ2DanNet::Observe::callback(Node::Reader&& args) {
+    const std::string& from = args.from();
+    uint32_t key;
     std::string query;
 
     try {
-        received >> from >> group >> key >> query;
-        //DebugSpewAlways("OBSERVE --> FROM: %s, GROUP: %s, QUERY: %s", from.c_str(), group.c_str(), query.c_str());
+        std::tie(key, query) = unpack(args);
+        //DebugSpewAlways("OBSERVE --> FROM: %s, GROUP: %s, QUERY: %s", from.c_str(), args.group().c_str(), query.c_str());
 
-        std::stringstream args;
-        Archive<std::stringstream> ar(args);
+        Node::Buffer send_buffer;
+        Archive<Node::Buffer> send(send_buffer);
 
         // This can install invalid queries, which is by design. We have no way to determine when some queries are valid or invalid
-        ar << Node::get().register_observer(from, query) << Node::get().parse_query(query);
+        send << Node::get().register_observer(from, query) << Node::get().serve_value(query);
 
-        Node::get().respond(from, key, std::move(args));
+        Node::get().respond(from, key, std::move(send_buffer));
     } catch (std::runtime_error&) {
         DebugSpewAlways("MQ2DanNet::Observe -- Failed to deserialize.");
     }
@@ -1863,46 +3077,32 @@ const bool MQ2DanNet::Observe::callback(std::stringstream&& args) {
     return false;
 }
 
-std::stringstream MQ2DanNet::Observe::pack(const std::string& recipient, const std::string& query, const std::string& output) {
-    std::stringstream send_stream;
-    Archive<std::stringstream> send(send_stream);
-
+Node::Buffer MQ2DanNet::Observe::pack(const std::string& recipient, const std::string& query, const std::string& output) {
     std::string final_query = Node::get().trim_query(query);
 
     if (recipient == Node::get().name()) {
         std::string new_group = Node::get().register_observer(recipient, final_query);
         Node::get().observe(new_group, recipient, final_query);
-        Node::get().update(new_group, "NULL", output);
+        Node::get().update(new_group, Node::Value(), output);
 
-        std::stringstream self_send_stream;
-        Archive<std::stringstream> self_send(self_send_stream);
-
-        self_send << Node::get().name() << new_group << Node::get().parse_query(final_query);
-        Update::callback(std::move(self_send_stream));
+        Node::deliver<Update>(Node::get().name(), new_group, Node::get().parse_value(final_query));
 
         // this isn't going to get sent anywhere.
-        return std::stringstream();
+        return Node::Buffer();
     }
 
     // this is the callback to actually start observing. We can't just do it because the observed will come back with the right group
-    auto f = [final_query, output = move(output)](std::stringstream&& args) -> bool {
-        Archive<std::stringstream> ar(args);
-        std::string from;
-        std::string group;
+    auto f = [final_query, output = move(output)](Node::Reader&& args) -> bool {
         std::string new_group;
-        std::string data;
+        Node::Value data;
 
         try {
-            ar >> from >> group >> new_group >> data;
+            args >> new_group >> data;
             if (!new_group.empty()) {
-                Node::get().observe(new_group, from, final_query);
-                Node::get().update(new_group, "NULL", output);
-
-                std::stringstream self_send_stream;
-                Archive<std::stringstream> self_send(self_send_stream);
+                Node::get().observe(new_group, args.from(), final_query);
+                Node::get().update(new_group, Node::Value(), output);
 
-                self_send << Node::get().name() << new_group << data;
-                Update::callback(std::move(self_send_stream));
+                Node::deliver<Update>(Node::get().name(), new_group, data);
             }
         } catch (std::runtime_error&) {
             DebugSpewAlways("MQ2DanNet::Observe -- response -- Failed to deserialize.");
@@ -1912,61 +3112,33 @@ std::stringstream MQ2DanNet::Observe::pack(const std::string& recipient, const s
     };
 
     // this registers the response from the observed that responds with a group name
-    std::string key = Node::get().register_response(f);
-    send << key << final_query;
-    return send_stream;
+    uint32_t key = Node::get().register_response(f);
+    return encode(key, final_query);
 }
 
-const bool MQ2DanNet::Update::callback(std::stringstream&& args) {
-    Archive<std::stringstream> received(args);
-    std::string from;
-    std::string group;
-    std::string data;
+const bool MQ2DanNet::Update::callback(Node::Reader&& args) {
+    const std::string& group = args.group();
+    Node::Value data;
 
     try {
-        received >> from >> group >> data;
-        Node::get().remove_commands([from, group, &data](std::pair<std::string, std::stringstream>& command) -> bool {
-            if (command.first == Node::name<Update>()) {
-                std::stringstream args_copy(command.second.str());
-                Archive<std::stringstream> recv(args_copy);
-                std::string copy_from, copy_group, copy_data;
-
-                recv >> copy_from >> copy_group >> copy_data;
-                if (from == copy_from && group == copy_group) {
-                    //DebugSpewAlways("DROPPING EXTRA UPDATE --> FROM: %s, GROUP: %s", from.c_str(), group.c_str());
-                    data = copy_data;
-                    return true;
-                }
-            }
-
-            return false;
-        });
+        std::tie(data) = unpack(args);
 
-        //DebugSpewAlways("UPDATE --> FROM: %s, GROUP: %s, DATA: %s", from.c_str(), group.c_str(), data.c_str());
+        //DebugSpewAlways("UPDATE --> FROM: %s, GROUP: %s, DATA: %s", args.from().c_str(), group.c_str(), data.to_string().c_str());
 
-        std::string output = Node::get().read(group).output;
+        const Node::Observation* observed = Node::get().observed(group);
+        std::string output = observed ? observed->output : std::string();
         CHAR szOutput[MAX_STRING] = { 0 };
         strcpy_s(szOutput, output.c_str());
 
         if (output.empty() || FindMQ2DataVariable(szOutput)) {
-            MQ2TYPEVAR Result = Node::get().parse_response(output, data);
-
-            CHAR szBuf[MAX_STRING] = { 0 };
-            if (Result.Type)
-                Result.Type->ToString(Result.VarPtr, szBuf);
-            else
-                strcpy_s(szBuf, "NULL");
+            // the value is stored as it came in, it only gets turned into a string if somebody reads it
+            if (!output.empty())
+                Node::get().parse_response(output, data);
 
-            Node::get().update(group, std::string(szBuf), output);
+            Node::get().update(group, data, output);
 
-            if (Node::get().debugging()) {
-                if (Result.Type) {
-                    CHAR szData[MAX_STRING] = { 0 };
-                    Result.Type->ToString(Result.VarPtr, szData);
-                    WriteChatf("%s : %s -- %llu (%llu)", Result.Type->GetName(), szData, Node::get().read(group).received, MQGetTickCount64());
-                } else
-                    WriteChatf("Failed to read data %s into %s at %llu.", data.c_str(), output.c_str(), MQGetTickCount64());
-            }
+            if (Node::get().debugging())
+                WriteChatf("%s : %s -- %llu (%llu)", data.type_name(), data.to_string().c_str(), Node::get().read(group).received, MQGetTickCount64());
         } else {
             // if we are storing to a variable, we need to drop the observer if the variable goes out of scope
             Node::get().forget(group);
@@ -1980,24 +3152,54 @@ const bool MQ2DanNet::Update::callback(std::stringstream&& args) {
     return false;
 }
 
-std::stringstream MQ2DanNet::Update::pack(const std::string& recipient, const std::string& result) {
-    std::stringstream send_stream;
+Node::Buffer MQ2DanNet::Update::pack(const std::string& recipient, const Node::Value& result) {
+    return encode(result);
+}
+
+// the actor normally splits these into individual updates before they are queued, so this only sees batches that skip the
+// queue -- which is our own, from publish
+const bool MQ2DanNet::UpdateBatch::callback(Node::Reader&& args) {
+    std::map<std::string, Node::Value> results;
+
+    try {
+        std::tie(results) = unpack(args);
+    } catch (std::runtime_error&) {
+        DebugSpewAlways("MQ2DanNet::UpdateBatch -- Failed to deserialize.");
+        return false;
+    }
+
+    for (auto& result : results)
+        Node::deliver<Update>(args.from(), result.first, result.second);
+
+    return false;
+}
+
+const bool MQ2DanNet::Forget::callback(Node::Reader&& args) {
+    std::string observer_group;
 
-    Archive<std::stringstream> send(send_stream);
-    send << result;
+    try {
+        std::tie(observer_group) = unpack(args);
+        Node::get().unsubscribe(observer_group, args.from());
+    } catch (std::runtime_error&) {
+        DebugSpewAlways("MQ2DanNet::Forget -- Failed to deserialize.");
+    }
 
-    // Update is never whispered, so we can assume that recipient is the group to update
-    auto groups = Node::get().get_own_groups();
-    if (groups.find(recipient) != groups.end()) {
-        // also need to send this to self if we are observing self
-        std::stringstream self_send_stream;
-        Archive<std::stringstream> self_send(self_send_stream);
+    return false;
+}
 
-        self_send << Node::get().name() << recipient << result;
-        callback(std::move(self_send_stream));
+Node::Buffer MQ2DanNet::Forget::pack(const std::string& recipient, const std::string& group) {
+    if (recipient == Node::get().name()) {
+        // observing self, just drop it here
+        Node::get().unsubscribe(group, recipient);
+        return Node::Buffer();
     }
 
-    return send_stream;
+    return encode(group);
+}
+
+// publish hands our own batch to deliver instead of packing it for us, so this only ever encodes
+Node::Buffer MQ2DanNet::UpdateBatch::pack(const std::string& recipient, const std::map<std::string, Node::Value>& results) {
+    return encode(results);
 }
 
 #pragma endregion
@@ -2027,6 +3229,12 @@ std::string GetDefault(const std::string& val) {
         return std::string("off");
     else if (val == "Observe Delay")
         return std::string("1000");
+    else if (val == "Pulse Budget")
+        return std::string("1000");
+    else if (val == "Observe Budget")
+        return std::string("500");
+    else if (val == "Query Max Age")
+        return std::string("0");
     else if (val == "Evasive")
         return std::string("1000");
     else if (val == "Expired")
@@ -2084,21 +3292,26 @@ BOOL ReadBool(const std::string& key) {
     return ReadBool("General", key);
 }
 
-std::string CreateArray(const std::set<std::string>& members) {
+template <typename T>
+std::string CreateArray(const T& members) {
+    std::string array;
     if (!members.empty()) {
-        std::string delimiter = "|";
-        auto accum = std::accumulate(members.cbegin(), members.cend(), std::string(),
-            [delimiter](const std::string& s, const std::string& p) {
-                return s + (s.empty() ? std::string() : delimiter) + p;
-            });
+        // one delimiter per member either way, it's just a matter of which end the extra one goes on
+        array.reserve(std::accumulate(members.cbegin(), members.cend(), members.size(),
+            [](std::size_t size, const std::string& member) { return size + member.size(); }));
+
+        bool front = Node::get().front_delimiter();
+        for (auto& member : members) {
+            if (front || !array.empty())
+                array += '|';
+            array += member;
+        }
 
-        if (Node::get().front_delimiter())
-            return delimiter + accum;
-        else
-            return accum + delimiter;
+        if (!front)
+            array += '|';
     }
 
-    return std::string();
+    return array;
 }
 
 std::set<std::string> ParseArray(const std::string& arr) {
@@ -2150,7 +3363,7 @@ public:
         if (!pObservation)
             return false;
 
-        strcpy_s(Destination, MAX_STRING, pObservation->data.c_str());
+        pObservation->data.to_string(Destination);
         return true;
     }
 
@@ -2180,11 +3393,104 @@ class MQ2DanNetType* pDanNetType = nullptr;
 class MQ2DanNetType : public MQ2Type {
 private:
     std::string _peer;
-    std::set<std::string> _peers;
-    std::set<std::string> _groups;
-    std::set<std::string> _joined;
     CHAR _buf[MAX_STRING];
 
+    // a list as it's shown (array) and as it's indexed (members[n - 1]), which aren't always in the same order
+    struct CachedArray final {
+        std::vector<std::string> members;
+        std::string array;
+    };
+
+    // lists are only rebuilt when what they came from changes version, or names start being shown differently. Keys are
+    // whatever the list is of, and TLO indices can make up new ones, so the whole thing goes once it's big
+    struct ArrayCache final {
+        unsigned int version;
+        BOOL full_names;
+        BOOL front_delimiter;
+        std::unordered_map<std::string, CachedArray> arrays;
+
+        ArrayCache() : version(0), full_names(false), front_delimiter(false) {}
+
+        template <typename F>
+        const CachedArray& get(unsigned int current, const std::string& key, F build) {
+            BOOL full = Node::get().full_names();
+            BOOL front = Node::get().front_delimiter();
+            if (version != current || full_names != full || front_delimiter != front || arrays.size() >= 256) {
+                arrays.clear();
+                version = current;
+                full_names = full;
+                front_delimiter = front;
+            }
+
+            auto array_it = arrays.find(key);
+            if (array_it == arrays.end()) {
+                array_it = arrays.emplace(key, CachedArray()).first;
+                build(array_it->second);
+            }
+
+            return array_it->second;
+        }
+    };
+
+    ArrayCache _directory_arrays; // peers and groups, against the directory version
+    ArrayCache _observer_arrays;  // observers and observed queries, against the observer version
+
+    // peers are indexed in full name order, but listed in the order they're shown in
+    static void build_peers(CachedArray& cached, const std::set<std::string>& peers) {
+        cached.members.reserve(peers.size());
+        for (auto& peer : peers)
+            cached.members.push_back(Node::get().get_name(peer));
+
+        if (Node::get().full_names()) {
+            cached.array = CreateArray(peers);
+        } else {
+            std::set<std::string> out;
+            std::transform(peers.cbegin(), peers.cend(), std::inserter(out, out.begin()), [](const std::string& s) -> std::string {
+                return Node::get().get_short_name(s);
+            });
+            cached.array = CreateArray(out);
+        }
+    }
+
+    static void build_list(CachedArray& cached, const std::set<std::string>& list) {
+        cached.members.assign(list.cbegin(), list.cend());
+        cached.array = CreateArray(cached.members);
+    }
+
+    const CachedArray& peers() {
+        return _directory_arrays.get(Node::get().directory().version, "peers", [](CachedArray& cached) {
+            build_peers(cached, Node::get().get_peers());
+        });
+    }
+
+    const CachedArray& group_peers(const std::string& group) {
+        return _directory_arrays.get(Node::get().directory().version, "peers|" + group, [&group](CachedArray& cached) {
+            build_peers(cached, Node::get().get_group_peers(group));
+        });
+    }
+
+    const CachedArray& groups() {
+        return _directory_arrays.get(Node::get().directory().version, "groups", [](CachedArray& cached) {
+            build_list(cached, Node::get().get_all_groups());
+        });
+    }
+
+    const CachedArray& joined() {
+        return _directory_arrays.get(Node::get().directory().version, "joined", [](CachedArray& cached) {
+            build_list(cached, Node::get().get_own_groups());
+        });
+    }
+
+    // false (and _buf untouched) if the 1-based index is out of range
+    bool copy_member(const CachedArray& cached, const char* index) {
+        int idx = atoi(index) - 1;
+        if (idx < 0 || idx >= static_cast<int>(cached.members.size()))
+            return false;
+
+        strcpy_s(_buf, cached.members[idx].c_str());
+        return true;
+    }
+
     Node::Observation _current_observation;
 
 public:
@@ -2197,7 +3503,17 @@ public:
         FullNames,
         FrontDelim,
         Timeout,
+        QueryMaxAge,
+        QCacheHits,
+        QCacheMisses,
         ObserveDelay,
+        ObserveBudget,
+        PulseBudget,
+        PulseDrained,
+        PulseDeferred,
+        PulseOldest,
+        InboxOverflow,
+        InboxHighWater,
         Evasive,
         Expired,
         Keepalive,
@@ -2215,10 +3531,19 @@ public:
         ObserveCount,
         OSet,
         ObserveSet,
+        ObserveInterval,
+        ObserveCost,
+        ObserveChurn,
         Q,
         Query,
         QReceived,
-        QueryReceived
+        QueryReceived,
+        QHandles,
+        QPending,
+        GQ,
+        GroupQuery,
+        GQPeers,
+        GQPending
     };
 
     MQ2DanNetType() : MQ2Type("DanNet") {
@@ -2230,7 +3555,17 @@ public:
         TypeMember(FullNames);
         TypeMember(FrontDelim);
         TypeMember(Timeout);
+        TypeMember(QueryMaxAge);
+        TypeMember(QCacheHits);
+        TypeMember(QCacheMisses);
         TypeMember(ObserveDelay);
+        TypeMember(ObserveBudget);
+        TypeMember(PulseBudget);
+        TypeMember(PulseDrained);
+        TypeMember(PulseDeferred);
+        TypeMember(PulseOldest);
+        TypeMember(InboxOverflow);
+        TypeMember(InboxHighWater);
         TypeMember(Evasive);
         TypeMember(Expired);
         TypeMember(Keepalive);
@@ -2246,19 +3581,28 @@ public:
         TypeMember(ObserveCount);
         TypeMember(OSet);
         TypeMember(ObserveSet);
+        TypeMember(ObserveInterval);
+        TypeMember(ObserveCost);
+        TypeMember(ObserveChurn);
         TypeMember(OReceived);
         TypeMember(ObserveReceived);
         TypeMember(Q);
         TypeMember(Query);
         TypeMember(QReceived);
         TypeMember(QueryReceived);
+        TypeMember(QHandles);
+        TypeMember(QPending);
+        TypeMember(GQ);
+        TypeMember(GroupQuery);
+        TypeMember(GQPeers);
+        TypeMember(GQPending);
     }
 
     bool GetMember(MQ2VARPTR VarPtr, char* Member, char* Index, MQ2TYPEVAR& Dest) {
         _buf[0] = '\0';
 
-        std::string local_peer = _peer;
-        _peer.clear();
+        std::string local_peer;
+        local_peer.swap(_peer);
 
         PMQ2TYPEMEMBER pMember = MQ2DanNetType::FindMember(Member);
         if (!pMember)
@@ -2300,10 +3644,50 @@ public:
             Dest.Ptr = &_buf[0];
             Dest.Type = pStringType;
             return true;
+        case QueryMaxAge:
+            Dest.DWord = Node::get().query_max_age();
+            Dest.Type = pIntType;
+            return true;
+        case QCacheHits:
+            Dest.DWord = Node::get().query_cache_hits();
+            Dest.Type = pIntType;
+            return true;
+        case QCacheMisses:
+            Dest.DWord = Node::get().query_cache_misses();
+            Dest.Type = pIntType;
+            return true;
         case ObserveDelay:
             Dest.DWord = Node::get().observe_delay();
             Dest.Type = pIntType;
             return true;
+        case ObserveBudget:
+            Dest.DWord = Node::get().observe_budget();
+            Dest.Type = pIntType;
+            return true;
+        case PulseBudget:
+            Dest.DWord = Node::get().pulse_budget();
+            Dest.Type = pIntType;
+            return true;
+        case PulseDrained:
+            Dest.DWord = Node::get().pulse_stats().drained;
+            Dest.Type = pIntType;
+            return true;
+        case PulseDeferred:
+            Dest.DWord = Node::get().pulse_stats().deferred;
+            Dest.Type = pIntType;
+            return true;
+        case PulseOldest:
+            Dest.UInt64 = Node::get().pulse_stats().oldest;
+            Dest.Type = pInt64Type;
+            return true;
+        case InboxOverflow:
+            Dest.DWord = Node::get().inbox_overflow();
+            Dest.Type = pIntType;
+            return true;
+        case InboxHighWater:
+            Dest.DWord = Node::get().inbox_high_water();
+            Dest.Type = pIntType;
+            return true;
         case Evasive:
             Dest.DWord = Node::get().evasive();
             Dest.Type = pIntType;
@@ -2318,109 +3702,87 @@ public:
             return true;
         case PeerCount:
             if (IsNumber(Index)) {
-                if (_groups.empty())
-                    _groups = Node::get().get_all_groups();
+                const CachedArray& all_groups = groups();
                 int idx = atoi(Index) - 1;
-                auto group_it = _groups.cbegin();
-                std::advance(group_it, idx);
-                if (group_it != _groups.cend())
-                    Dest.DWord = Node::get().get_group_peers(*group_it).size();
+                if (idx >= 0 && idx < static_cast<int>(all_groups.members.size()))
+                    Dest.DWord = Node::get().get_group_peers(all_groups.members[idx]).size();
                 else
                     return false;
             } else if (Index && Index[0] != '\0') {
                 Dest.DWord = Node::get().get_group_peers(Node::init_string(Index)).size();
             } else {
-                _peers = Node::get().get_peers();
-                Dest.DWord = _peers.size();
+                Dest.DWord = Node::get().get_peers().size();
             }
             Dest.Type = pIntType;
             return true;
         case Peers:
             if (IsNumber(Index)) {
-                if (_peers.empty())
-                    _peers = Node::get().get_peers();
-                int idx = atoi(Index) - 1;
-                auto peer_it = _peers.cbegin();
-                std::advance(peer_it, idx);
-                if (peer_it != _peers.cend()) {
-                    std::string out = Node::get().get_name(*peer_it);
-                    strcpy_s(_buf, out.c_str());
-                } else
+                if (!copy_member(peers(), Index))
                     return false;
             } else if (Index && Index[0] != '\0') {
-                auto peers = Node::get().get_group_peers(Node::init_string(Index));
-                std::set<std::string> out;
-                if (Node::get().full_names())
-                    out = peers;
-                else {
-                    std::transform(peers.cbegin(), peers.cend(), std::inserter(out, out.begin()), [](std::string s) -> std::string {
-                        return Node::get().get_short_name(s);
-                    });
-                }
-                strcpy_s(_buf, CreateArray(out).c_str());
+                strcpy_s(_buf, group_peers(Node::init_string(Index)).array.c_str());
             } else {
-                auto peers = Node::get().get_peers();
-                std::set<std::string> out;
-                if (Node::get().full_names())
-                    out = peers;
-                else {
-                    std::transform(peers.cbegin(), peers.cend(), std::inserter(out, out.begin()), [](std::string s) -> std::string {
-                        return Node::get().get_short_name(s);
-                    });
-                }
-                strcpy_s(_buf, CreateArray(out).c_str());
+                strcpy_s(_buf, peers().array.c_str());
             }
 
             Dest.Ptr = &_buf[0];
             Dest.Type = pStringType;
             return true;
         case GroupCount:
-            _groups = Node::get().get_all_groups();
-            Dest.DWord = _groups.size();
+            Dest.DWord = Node::get().get_all_groups().size();
             Dest.Type = pIntType;
             return true;
         case Groups:
             if (IsNumber(Index)) {
-                if (_groups.empty())
-                    _groups = Node::get().get_all_groups();
-                int idx = atoi(Index) - 1;
-                auto group_it = _groups.cbegin();
-                std::advance(group_it, idx);
-                if (group_it != _groups.cend())
-                    strcpy_s(_buf, group_it->c_str());
-                else
+                if (!copy_member(groups(), Index))
                     return false;
             } else {
-                strcpy_s(_buf, CreateArray(Node::get().get_all_groups()).c_str());
+                strcpy_s(_buf, groups().array.c_str());
             }
             Dest.Ptr = &_buf[0];
             Dest.Type = pStringType;
             return true;
         case JoinedCount:
-            _joined = Node::get().get_own_groups();
-            Dest.DWord = _groups.size();
+            Dest.DWord = Node::get().get_own_groups().size();
             Dest.Type = pIntType;
             return true;
         case Joined:
             if (IsNumber(Index)) {
-                if (_joined.empty())
-                    _joined = Node::get().get_own_groups();
-                int idx = atoi(Index) - 1;
-                auto group_it = _joined.cbegin();
-                std::advance(group_it, idx);
-                if (group_it != _joined.cend())
-                    strcpy_s(_buf, group_it->c_str());
-                else
+                if (!copy_member(joined(), Index))
                     return false;
             } else {
-                strcpy_s(_buf, CreateArray(Node::get().get_own_groups()).c_str());
+                strcpy_s(_buf, joined().array.c_str());
             }
             Dest.Ptr = &_buf[0];
             Dest.Type = pStringType;
             return true;
+        case ObserveInterval:
+        case ObserveCost:
+        case ObserveChurn:
+            if (Index && Index[0] != '\0') {
+                Node::ObserverRate rate;
+                if (!Node::get().observer_rate(Node::get().trim_query(Index), rate))
+                    return false;
+
+                if ((Members)pMember->ID == ObserveInterval)
+                    Dest.DWord = rate.interval;
+                else if ((Members)pMember->ID == ObserveCost)
+                    Dest.DWord = rate.cost;
+                else
+                    Dest.DWord = rate.churn;
+                Dest.Type = pIntType;
+                return true;
+            }
+
+            return false;
         case Q:
         case Query:
-            _current_observation = Node::Observation(Node::get().query());
+            if (IsNumber(Index)) {
+                if (!Node::get().query(atoi(Index), _current_observation))
+                    return false;
+            } else {
+                _current_observation = Node::Observation(Node::get().query());
+            }
 
             if (_current_observation.received != 0) {
                 Dest.Ptr = &_current_observation;
@@ -2430,25 +3792,92 @@ public:
                 return false;
         case QReceived:
         case QueryReceived:
-            _current_observation = Node::Observation(Node::get().query());
+            if (IsNumber(Index)) {
+                if (!Node::get().query(atoi(Index), _current_observation))
+                    return false;
+            } else {
+                _current_observation = Node::Observation(Node::get().query());
+            }
+
             Dest.UInt64 = _current_observation.received;
             Dest.Type = pInt64Type;
             return true;
+        case QHandles: {
+            std::vector<std::string> handles;
+            for (auto handle : Node::get().query_batch())
+                handles.push_back(std::to_string(handle));
+
+            strcpy_s(_buf, CreateArray(handles).c_str());
+            Dest.Ptr = &_buf[0];
+            Dest.Type = pStringType;
+            return true;
+        }
+        case QPending:
+            Dest.DWord = Node::get().query_pending();
+            Dest.Type = pIntType;
+            return true;
+        case GQ:
+        case GroupQuery:
+            if (Index && Index[0] != '\0') {
+                auto peer = Node::init_string(Index);
+                if (std::string::npos == peer.find_last_of("_"))
+                    peer = Node::get().get_full_name(peer);
+
+                if (!Node::get().group_query(peer, _current_observation))
+                    return false;
+
+                Dest.Ptr = &_current_observation;
+                Dest.Type = pDanObservationType;
+                return true;
+            } else {
+                // in the same order as GQPeers, anybody that hasn't answered is NULL
+                std::vector<std::string> results;
+                for (auto& peer : Node::get().group_query_peers()) {
+                    Node::Observation obs;
+                    Node::get().group_query(peer, obs);
+                    results.push_back(obs.data.to_string());
+                }
+
+                strcpy_s(_buf, CreateArray(results).c_str());
+                Dest.Ptr = &_buf[0];
+                Dest.Type = pStringType;
+                return true;
+            }
+        case GQPeers: {
+            std::vector<std::string> peers;
+            for (auto& peer : Node::get().group_query_peers())
+                peers.push_back(Node::get().get_name(peer));
+
+            strcpy_s(_buf, CreateArray(peers).c_str());
+            Dest.Ptr = &_buf[0];
+            Dest.Type = pStringType;
+            return true;
+        }
+        case GQPending:
+            Dest.DWord = Node::get().group_query_pending();
+            Dest.Type = pIntType;
+            return true;
         case O:
         case Observe:
             if (!local_peer.empty()) {
                 if (Index && Index[0] != '\0') {
-                    _current_observation = Node::get().read(local_peer, Node::get().trim_query(Index));
-
-                    if (_current_observation.received != 0) {
-                        Dest.Ptr = &_current_observation;
+                    const Node::Observation* observed = Node::get().observed(local_peer, Index);
+
+                    if (observed && observed->received != 0) {
+                        // this points right into an observation_table slot, and slots move when the table grows or an
+                        // entry is erased. That only happens in observe/forget/update, which run from command callbacks
+                        // in OnPulse -- never while MQ2 is still walking this member chain -- and /declare'd variables
+                        // take their own copy in MQ2DanObservationType::FromData
+                        Dest.Ptr = const_cast<Node::Observation*>(observed);
                         Dest.Type = pDanObservationType;
                         return true;
                     } else
                         return false;
                 } else {
-                    auto observers = Node::get().observed_queries(local_peer);
-                    strcpy_s(_buf, CreateArray(observers).c_str());
+                    const CachedArray& observed = _observer_arrays.get(Node::get().observer_version(), "observed|" + local_peer, [&local_peer](CachedArray& cached) {
+                        build_list(cached, Node::get().observed_queries(local_peer));
+                    });
+                    strcpy_s(_buf, observed.array.c_str());
 
                     Dest.Ptr = &_buf[0];
                     Dest.Type = pStringType;
@@ -2456,11 +3885,16 @@ public:
                 }
             } else {
                 if (Index && Index[0] != '\0') {
-                    auto observers = Node::get().observers(Node::get().trim_query(Index));
-                    strcpy_s(_buf, CreateArray(observers).c_str());
+                    std::string query = Node::get().trim_query(Index);
+                    const CachedArray& observers = _observer_arrays.get(Node::get().observer_version(), "observers|" + query, [&query](CachedArray& cached) {
+                        build_list(cached, Node::get().observers(query));
+                    });
+                    strcpy_s(_buf, observers.array.c_str());
                 } else {
-                    auto observers = Node::get().observer_queries();
-                    strcpy_s(_buf, CreateArray(observers).c_str());
+                    const CachedArray& queries = _observer_arrays.get(Node::get().observer_version(), "queries", [](CachedArray& cached) {
+                        build_list(cached, Node::get().observer_queries());
+                    });
+                    strcpy_s(_buf, queries.array.c_str());
                 }
 
                 Dest.Ptr = &_buf[0];
@@ -2501,8 +3935,8 @@ public:
         case OReceived:
         case ObserveReceived:
             if (!local_peer.empty() && Index && Index[0] != '\0') {
-                _current_observation = Node::get().read(local_peer, Node::get().trim_query(Index));
-                Dest.UInt64 = _current_observation.received;
+                const Node::Observation* observed = Node::get().observed(local_peer, Index);
+                Dest.UInt64 = observed ? observed->received : 0;
                 Dest.Type = pInt64Type;
                 return true;
             } else
@@ -2616,6 +4050,27 @@ PLUGIN_API VOID DNetCommand(PSPAWNINFO pSpawn, PCHAR szLine) {
         else
             SetVar("General", "Observe Delay", GetDefault("Observe Delay"));
         Node::get().observe_delay(atoi(ReadVar("Observe Delay").c_str()));
+    } else if (szParam && !strcmp(szParam, "maxage")) {
+        GetArg(szParam, szLine, 2);
+        if (szParam && IsNumber(szParam))
+            SetVar("General", "Query Max Age", szParam);
+        else
+            SetVar("General", "Query Max Age", GetDefault("Query Max Age"));
+        Node::get().query_max_age(atoi(ReadVar("Query Max Age").c_str()));
+    } else if (szParam && !strcmp(szParam, "observebudget")) {
+        GetArg(szParam, szLine, 2);
+        if (szParam && IsNumber(szParam))
+            SetVar("General", "Observe Budget", szParam);
+        else
+            SetVar("General", "Observe Budget", GetDefault("Observe Budget"));
+        Node::get().observe_budget(atoi(ReadVar("Observe Budget").c_str()));
+    } else if (szParam && !strcmp(szParam, "pulsebudget")) {
+        GetArg(szParam, szLine, 2);
+        if (szParam && IsNumber(szParam))
+            SetVar("General", "Pulse Budget", szParam);
+        else
+            SetVar("General", "Pulse Budget", GetDefault("Pulse Budget"));
+        Node::get().pulse_budget(atoi(ReadVar("Pulse Budget").c_str()));
     } else if (szParam && !strcmp(szParam, "evasive")) {
         GetArg(szParam, szLine, 2);
         if (szParam && IsNumber(szParam))
@@ -2653,7 +4108,10 @@ PLUGIN_API VOID DNetCommand(PSPAWNINFO pSpawn, PCHAR szLine) {
         WriteChatf("           \ayfullnames [on|off]\ax -- turn fullnames on or off");
         WriteChatf("           \ayfrontdelim [on|off]\ax -- turn front delimiters on or off");
         WriteChatf("           \aytimeout [new_timeout]\ax -- set the /dquery timeout");
+        WriteChatf("           \aymaxage [new_max_age]\ax -- set how old a cached result can be for /dquery to use it in ms, 0 always asks");
         WriteChatf("           \ayobservedelay [new_delay]\ax -- set the delay between observe sends in ms");
+        WriteChatf("           \ayobservebudget [new_budget]\ax -- set the time spent evaluating observers each pulse in us");
+        WriteChatf("           \aypulsebudget [new_budget]\ax -- set the time spent handling incoming commands each pulse in us");
         WriteChatf("           \ayevasive [new_evasive]\ax -- set the evasive timeout in ms");
         WriteChatf("           \ayexpired [new_expired]\ax -- set the expired timeout in ms");
         WriteChatf("           \aykeepalive [new_keepalive]\ax -- set the keepalive time for non-responding peers in ms");
@@ -2739,7 +4197,7 @@ PLUGIN_API VOID DGtellCommand(PSPAWNINFO pSpawn, PCHAR szLine) {
     auto group = Node::init_string(szGroup);
     std::string message(szLine);
 
-    std::set<std::string> groups = Node::get().get_all_groups();
+    const std::set<std::string>& groups = Node::get().get_all_groups();
     if (groups.find(group) != groups.end()) {
         std::string::size_type n = message.find_first_not_of(" \t", 0);
         n = message.find_first_of(" \t", n);
@@ -2786,7 +4244,7 @@ PLUGIN_API VOID DGexecuteCommand(PSPAWNINFO pSpawn, PCHAR szLine) {
 
     auto replace_qualifier = [&group, &command](const std::string& qualifier) {
         if (group == qualifier) {
-            std::set<std::string> groups = Node::get().get_own_groups();
+            const std::set<std::string>& groups = Node::get().get_own_groups();
             auto group_it = std::find_if(groups.cbegin(), groups.cend(), [&qualifier](const std::string& group_name) {
                 return group_name.find(qualifier + "_") == 0;
             });
@@ -2806,7 +4264,7 @@ PLUGIN_API VOID DGexecuteCommand(PSPAWNINFO pSpawn, PCHAR szLine) {
     replace_qualifier("raid");
     replace_qualifier("zone");
 
-    std::set<std::string> groups = Node::get().get_all_groups();
+    const std::set<std::string>& groups = Node::get().get_all_groups();
     if (group.find("/") == 0) {
         // we can assume that '/' signifies the start of a command, so we haven't specified a group
         group = "all";
@@ -2854,7 +4312,7 @@ PLUGIN_API VOID DGAexecuteCommand(PSPAWNINFO pSpawn, PCHAR szLine) {
 
     auto replace_qualifier = [&group, &command](const std::string& qualifier) {
         if (group == qualifier) {
-            std::set<std::string> groups = Node::get().get_own_groups();
+            const std::set<std::string>& groups = Node::get().get_own_groups();
             auto group_it = std::find_if(groups.cbegin(), groups.cend(), [&qualifier](const std::string& group_name) {
                 return group_name.find(qualifier + "_") == 0;
             });
@@ -2874,7 +4332,7 @@ PLUGIN_API VOID DGAexecuteCommand(PSPAWNINFO pSpawn, PCHAR szLine) {
     replace_qualifier("raid");
     replace_qualifier("zone");
 
-    std::set<std::string> groups = Node::get().get_all_groups();
+    const std::set<std::string>& groups = Node::get().get_all_groups();
     if (group.find("/") == 0) {
         // we can assume that '/' signifies the start of a command, so we haven't specified a group
         group = "all";
@@ -2894,7 +4352,7 @@ PLUGIN_API VOID DGAexecuteCommand(PSPAWNINFO pSpawn, PCHAR szLine) {
             WriteChatf("\ax\a-o[\ax\ao -->\ax\a-o(%s) ]\ax \aw%s\ax", group.c_str(), command.c_str());
         Node::get().shout<MQ2DanNet::Execute>(group, command);
 
-        std::string final_command = std::regex_replace(command, std::regex("\\$\\\\\\{"), "${");
+        std::string final_command = Node::unescape(command);
 
         CHAR szCommand[MAX_STRING] = { 0 };
         strcpy_s(szCommand, final_command.c_str());
@@ -2959,7 +4417,7 @@ PLUGIN_API VOID DObserveCommand(PSPAWNINFO pSpawn, PCHAR szLine) {
     } else if (name.empty() || query.empty()) {
         WriteChatColor("Syntax: /dobserve <name> [-q <query>] [-o <result>] [-drop] -- add an observer on name and update values in result, or drop the observer", USERCOLOR_DEFAULT);
     } else {
-        auto peers = Node::get().get_peers();
+        const auto& peers = Node::get().get_peers();
         if (peers.find(name) == peers.end()) {
             DebugSpewAlways("/dobserve: Can not find peer %s in %s!", name.c_str(), CreateArray(peers).c_str());
             return;
@@ -2971,70 +4429,142 @@ PLUGIN_API VOID DObserveCommand(PSPAWNINFO pSpawn, PCHAR szLine) {
 }
 
 PLUGIN_API VOID DQueryCommand(PSPAWNINFO pSpawn, PCHAR szLine) {
-    CHAR szName[MAX_STRING] = { 0 };
     CHAR szParam[MAX_STRING] = { 0 };
-    GetArg(szName, szLine, 1);
-    auto name = Node::init_string(szName);
-    if (std::string::npos == name.find_last_of("_"))
-        name = Node::get().get_full_name(name);
 
-    std::string query;
-    std::string output;
+    // any number of peers and queries, every peer gets asked every query
+    std::vector<std::string> names;
+    std::vector<std::string> queries;
+    std::vector<std::string> outputs;
     std::string timeout;
+    unsigned __int64 max_age = Node::get().query_max_age();
 
-    int current_param = 1;
+    int current_param = 0;
     do {
         GetArg(szParam, szLine, ++current_param);
         if (!strncmp(szParam, "-q", 2)) {
             GetArg(szParam, szLine, ++current_param);
-            if (szParam)
-                query = szParam;
+            if (szParam[0] != '\0')
+                queries.push_back(szParam);
         } else if (!strncmp(szParam, "-o", 2)) {
             GetArg(szParam, szLine, ++current_param);
-            if (szParam)
-                output = szParam;
+            if (szParam[0] != '\0')
+                outputs.push_back(szParam);
         } else if (!strncmp(szParam, "-t", 2)) {
             GetArg(szParam, szLine, ++current_param);
-            if (szParam)
+            if (szParam[0] != '\0')
                 timeout = szParam;
+        } else if (!strncmp(szParam, "-m", 2)) {
+            GetArg(szParam, szLine, ++current_param);
+            if (IsNumber(szParam))
+                max_age = atoi(szParam);
         } else if (szParam[0] == '-') {
             // don't understand the switch, let's just fast-forward
             ++current_param;
+        } else if (szParam[0] != '\0') {
+            auto name = Node::init_string(szParam);
+            if (std::string::npos == name.find_last_of("_"))
+                name = Node::get().get_full_name(name);
+            names.push_back(name);
         }
-    } while ((szParam && szParam[0] != '\0') || current_param > 10);
+    } while (szParam[0] != '\0');
 
-    if (name.empty() || query.empty()) {
-        WriteChatColor("Syntax: /dquery <name> [-q <query>] [-o <result>] [-t <timeout>] -- execute query on name and store return in result", USERCOLOR_DEFAULT);
-    } else if (name == Node::get().name()) {
-        // this is a self-query, let's just return the evaluation of the query
-        MQ2TYPEVAR Result = Node::get().parse_response(output, Node::get().parse_query(query).c_str());
-        CHAR szBuf[MAX_STRING] = { 0 };
-        if (Result.Type)
-            Result.Type->ToString(Result.VarPtr, szBuf);
-        else
-            strcpy_s(szBuf, "NULL");
+    if (names.empty() || queries.empty()) {
+        WriteChatColor("Syntax: /dquery <name> [<name> ...] [-q <query>] [-o <result>] [-t <timeout>] [-m <max_age>] -- execute each query on each name and store return in result", USERCOLOR_DEFAULT);
+        return;
+    }
 
-        Node::get().query_result(Node::Observation(output, std::string(szBuf), MQGetTickCount64()));
-    } else {
-        // reset the result so we can tell when we get a response. Needs to be done before the delay call.
-        Node::get().query_result(Node::Observation(output));
+    const auto& peers = Node::get().get_peers();
+    std::vector<unsigned int> handles;
+    bool remote = false;
 
-        auto peers = Node::get().get_peers();
-        if (peers.find(name) == peers.end()) {
+    for (auto& name : names) {
+        bool known = name == Node::get().name() || peers.find(name) != peers.end();
+        if (!known)
             DebugSpewAlways("/dquery: Can not find peer %s in %s!", name.c_str(), CreateArray(peers).c_str());
-            return;
+
+        for (std::size_t i = 0; i < queries.size(); ++i) {
+            // outputs go with the query in the same position, but only make sense for a single peer
+            std::string output = names.size() == 1 && i < outputs.size() ? outputs[i] : std::string();
+            unsigned int handle = Node::get().query_handle(output);
+            handles.push_back(handle);
+
+            Node::Observation cached;
+            if (!known) {
+                // still takes up its handle, so the handles line up and ${DanNet.Q} isn't left showing an older answer
+                Node::get().query_drop(handle);
+            } else if (name == Node::get().name()) {
+                // this is a self-query, let's just return the evaluation of the query
+                Node::Value data = Node::get().parse_value(queries[i]);
+                if (!output.empty())
+                    Node::get().parse_response(output, data);
+
+                Node::get().query_result(handle, Node::Observation(output, data, MQGetTickCount64()));
+            } else if (max_age > 0 && Node::get().cached_query(name, queries[i], max_age, cached)) {
+                // recent enough that asking again would just get the same answer
+                if (!output.empty())
+                    Node::get().parse_response(output, cached.data);
+
+                Node::get().query_result(handle, Node::Observation(output, cached.data, cached.received));
+            } else {
+                Node::get().whisper<Query>(name, queries[i], handle);
+                remote = true;
+            }
         }
+    }
 
+    Node::get().query_batch(handles);
+
+    if (remote) {
         if (timeout.empty())
             timeout = ReadVar("General", "Query Timeout");
 
+        // only the slowest answer holds the macro up
         PCHARINFO pChar = GetCharInfo();
         if (pChar) {
             CHAR szDelay[MAX_STRING] = { 0 };
-            strcpy_s(szDelay, (timeout + " ${DanNet.QReceived}").c_str());
+            strcpy_s(szDelay, (timeout + " ${DanNet.QPending}==0").c_str());
             Delay(pChar->pSpawn, szDelay);
+        }
+    }
+}
+
+PLUGIN_API VOID DGQueryCommand(PSPAWNINFO pSpawn, PCHAR szLine) {
+    CHAR szGroup[MAX_STRING] = { 0 };
+    CHAR szParam[MAX_STRING] = { 0 };
+    GetArg(szGroup, szLine, 1);
+    auto group = Node::init_string(szGroup);
+
+    std::string query;
+    std::string timeout;
+
+    int current_param = 1;
+    do {
+        GetArg(szParam, szLine, ++current_param);
+        if (!strncmp(szParam, "-q", 2)) {
+            GetArg(szParam, szLine, ++current_param);
+            query = szParam;
+        } else if (!strncmp(szParam, "-t", 2)) {
+            GetArg(szParam, szLine, ++current_param);
+            timeout = szParam;
+        } else if (szParam[0] == '-') {
+            // don't understand the switch, let's just fast-forward
+            ++current_param;
+        }
+    } while (szParam[0] != '\0');
 
-            Node::get().whisper<Query>(name, query);
+    if (group.empty() || query.empty()) {
+        WriteChatColor("Syntax: /dgquery <group> [-q <query>] [-t <timeout>] -- execute query on every peer in group and gather the results", USERCOLOR_DEFAULT);
+    } else if (!Node::get().group_query(group, query)) {
+        DebugSpewAlways("/dgquery: Can not find any peers in %s!", group.c_str());
+    } else if (Node::get().group_query_pending() > 0) {
+        if (timeout.empty())
+            timeout = ReadVar("General", "Query Timeout");
+
+        PCHARINFO pChar = GetCharInfo();
+        if (pChar) {
+            CHAR szDelay[MAX_STRING] = { 0 };
+            strcpy_s(szDelay, (timeout + " ${DanNet.GQPending}==0").c_str());
+            Delay(pChar->pSpawn, szDelay);
         }
     }
 }
@@ -3050,6 +4580,8 @@ PLUGIN_API VOID InitializePlugin(VOID) {
     Node::get().register_command<MQ2DanNet::Query>();
     Node::get().register_command<MQ2DanNet::Observe>();
     Node::get().register_command<MQ2DanNet::Update>();
+    Node::get().register_command<MQ2DanNet::UpdateBatch>();
+    Node::get().register_command<MQ2DanNet::Forget>();
 
     Node::get().debugging(ReadBool("General", "Debugging"));
     Node::get().local_echo(ReadBool("General", "Local Echo"));
@@ -3065,6 +4597,30 @@ PLUGIN_API VOID InitializePlugin(VOID) {
         Node::get().observe_delay(atoi(GetDefault("Observe Delay").c_str()));
     }
 
+    CHAR query_max_age[MAX_STRING] = { 0 };
+    strcpy_s(query_max_age, ReadVar("Query Max Age").c_str());
+    if (IsNumber(query_max_age)) {
+        Node::get().query_max_age(atoi(query_max_age));
+    } else {
+        Node::get().query_max_age(atoi(GetDefault("Query Max Age").c_str()));
+    }
+
+    CHAR observe_budget[MAX_STRING] = { 0 };
+    strcpy_s(observe_budget, ReadVar("Observe Budget").c_str());
+    if (IsNumber(observe_budget)) {
+        Node::get().observe_budget(atoi(observe_budget));
+    } else {
+        Node::get().observe_budget(atoi(GetDefault("Observe Budget").c_str()));
+    }
+
+    CHAR pulse_budget[MAX_STRING] = { 0 };
+    strcpy_s(pulse_budget, ReadVar("Pulse Budget").c_str());
+    if (IsNumber(pulse_budget)) {
+        Node::get().pulse_budget(atoi(pulse_budget));
+    } else {
+        Node::get().pulse_budget(atoi(GetDefault("Pulse Budget").c_str()));
+    }
+
     CHAR evasive[MAX_STRING] = { 0 };
     strcpy_s(evasive, ReadVar("Evasive").c_str());
     if (IsNumber(evasive)) {
@@ -3105,6 +4661,7 @@ PLUGIN_API VOID InitializePlugin(VOID) {
     AddCommand("/dgzaexecute", DGZAexecuteCommand);
     AddCommand("/dobserve", DObserveCommand);
     AddCommand("/dquery", DQueryCommand);
+    AddCommand("/dgquery", DGQueryCommand);
 
     pDanNetType = new MQ2DanNetType;
     AddMQ2Data("DanNet", dataDanNet);
@@ -3127,6 +4684,8 @@ PLUGIN_API VOID ShutdownPlugin(VOID) {
     Node::get().unregister_command<MQ2DanNet::Query>();
     Node::get().unregister_command<MQ2DanNet::Observe>();
     Node::get().unregister_command<MQ2DanNet::Update>();
+    Node::get().unregister_command<MQ2DanNet::UpdateBatch>();
+    Node::get().unregister_command<MQ2DanNet::Forget>();
 
     RemoveCommand("/dnet");
     RemoveCommand("/djoin");
@@ -3144,6 +4703,7 @@ PLUGIN_API VOID ShutdownPlugin(VOID) {
     RemoveCommand("/dgzaexecute");
     RemoveCommand("/dobserve");
     RemoveCommand("/dquery");
+    RemoveCommand("/dgquery");
 
     RemoveMQ2Data("DanNet");
     delete pDanNetType;
@@ -3211,6 +4771,8 @@ PLUGIN_API VOID OnCleanUI(VOID) {
 
 // This is called every time MQ pulses
 PLUGIN_API VOID OnPulse(VOID) {
+    Node::get().quiescent();
+    Node::get().clear_parse_memo();
     Node::get().recv();
 
     if (Node::get().last_group_check() + 1000 < MQGetTickCount64()) {
@@ -3219,7 +4781,7 @@ PLUGIN_API VOID OnPulse(VOID) {
 
         // we need to get all channels we have joined that are group channels no matter what the case
         std::set<std::string> groups = ([]() {
-            std::set<std::string> own_groups = Node::get().get_own_groups();
+            const std::set<std::string>& own_groups = Node::get().get_own_groups();
             std::set<std::string> filtered_groups;
             std::copy_if(own_groups.cbegin(), own_groups.cend(), std::inserter(filtered_groups, filtered_groups.begin()), [](const std::string& group) {
                 return group.find("group_") == 0 || group.find("raid_") == 0 || group.find("zone_") == 0;
@@ -3280,7 +4842,10 @@ PLUGIN_API VOID OnPulse(VOID) {
     }
 
     Node::get().do_next();
-    Node::get().publish<Update>();
+    Node::get().expire_responses();
+    Node::get().resubscribe();
+    Node::get().report_rejected();
+    Node::get().publish<UpdateBatch>();
 }
 
 #pragma endregion
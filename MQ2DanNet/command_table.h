@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "wire.h"
+
+namespace MQ2DanNet {
+// commands are found by id in a flat open addressed table -- ids are already hashes, so the low bits pick the slot. A
+// slot keeps its id once it's claimed (unregistering just drops the callback) so probing never breaks, which is fine
+// because the only ids are the commands themselves
+class command_table {
+private:
+    static const std::size_t N = 64; // power of 2, comfortably more than the commands
+
+    struct entry {
+        bool used;
+        uint32_t id;
+        std::string name; // only for debugging
+        std::function<bool(Reader&&)> callback;
+
+        entry() : used(false), id(0) {}
+    };
+
+    std::mutex _mutex;
+    std::vector<entry> _entries;
+
+    // the slot holding id, or the empty slot it belongs in -- nullptr only if the table is full
+    entry* slot(uint32_t id) {
+        for (std::size_t i = 0; i < N; ++i) {
+            entry& e = _entries[(id + i) & (N - 1)];
+            if (!e.used || e.id == id)
+                return &e;
+        }
+
+        return nullptr;
+    }
+
+public:
+    command_table() : _entries(N) {}
+
+    // false if the id belongs to a different name (a hash collision) or the table is full
+    bool insert(uint32_t id, const std::string& name, std::function<bool(Reader&&)> callback) {
+        _mutex.lock();
+        entry* e = slot(id);
+        bool r = e && (!e->used || e->name == name);
+        if (r) {
+            e->used = true;
+            e->id = id;
+            e->name = name;
+            e->callback = std::move(callback);
+        }
+        _mutex.unlock();
+        return r;
+    }
+
+    void erase(uint32_t id) {
+        _mutex.lock();
+        entry* e = slot(id);
+        if (e && e->used)
+            e->callback = nullptr;
+        _mutex.unlock();
+    }
+
+    bool contains(uint32_t id) {
+        _mutex.lock();
+        entry* e = slot(id);
+        bool r = e && e->used;
+        _mutex.unlock();
+        return r;
+    }
+
+    std::string name(uint32_t id) {
+        _mutex.lock();
+        entry* e = slot(id);
+        std::string r = e && e->used ? e->name : std::to_string(id);
+        _mutex.unlock();
+        return r;
+    }
+
+    // the callback runs outside the lock so it's free to register commands of its own, and is dropped if it returns true
+    void dispatch(uint32_t id, Reader&& args) {
+        _mutex.lock();
+        entry* e = slot(id);
+        std::function<bool(Reader&&)> f;
+        if (e && e->used)
+            f = e->callback;
+        _mutex.unlock();
+
+        if (f && f(std::move(args)))
+            erase(id);
+    }
+};
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+namespace MQ2DanNet {
+// bounded multi-producer/single-consumer ring (after Vyukov's bounded queue). Producers claim a cell with a CAS on the
+// enqueue position and publish it through the cell's sequence number, so nothing ever blocks and ordering is strictly FIFO.
+// Only the game thread consumes, so popping doesn't need a CAS at all.
+template <typename T, std::size_t N>
+class mpsc_queue {
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "mpsc_queue size must be a power of 2");
+
+private:
+    struct cell {
+        std::atomic<std::size_t> sequence;
+        T data;
+    };
+
+    cell _cells[N];
+    alignas(64) std::atomic<std::size_t> _enqueue_pos;
+    alignas(64) std::atomic<std::size_t> _dequeue_pos;
+    std::atomic<std::size_t> _overflow;
+    std::atomic<std::size_t> _high_water;
+
+    void update_high_water(std::size_t depth) {
+        std::size_t current = _high_water.load(std::memory_order_relaxed);
+        while (depth > current && !_high_water.compare_exchange_weak(current, depth, std::memory_order_relaxed)) {
+        }
+    }
+
+public:
+    mpsc_queue() : _enqueue_pos(0), _dequeue_pos(0), _overflow(0), _high_water(0) {
+        for (std::size_t i = 0; i < N; ++i)
+            _cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    // any thread -- returns false and counts an overflow if the ring is full
+    bool push(T& e) {
+        std::size_t pos = _enqueue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell& c = _cells[pos & (N - 1)];
+            std::size_t seq = c.sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+            if (diff == 0) {
+                if (_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    // the depth has to be taken while the cell is still ours -- once it's published the consumer can pop
+                    // past it, and pos + 1 - _dequeue_pos would wrap
+                    std::size_t depth = pos + 1 - _dequeue_pos.load(std::memory_order_relaxed);
+                    c.data = std::move(e);
+                    c.sequence.store(pos + 1, std::memory_order_release);
+                    update_high_water(depth);
+                    return true;
+                }
+            } else if (diff < 0) {
+                _overflow.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            } else {
+                pos = _enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // consumer only
+    bool try_pop(T& r) {
+        std::size_t pos = _dequeue_pos.load(std::memory_order_relaxed);
+        cell& c = _cells[pos & (N - 1)];
+        std::size_t seq = c.sequence.load(std::memory_order_acquire);
+        if (static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1) < 0)
+            return false; // empty, or the next producer hasn't finished publishing yet
+
+        r = std::move(c.data);
+        // advance before handing the cell back, so a producer that reuses it never sees a depth of more than N
+        _dequeue_pos.store(pos + 1, std::memory_order_relaxed);
+        c.sequence.store(pos + N, std::memory_order_release);
+        return true;
+    }
+
+    std::size_t size() {
+        return _enqueue_pos.load(std::memory_order_relaxed) - _dequeue_pos.load(std::memory_order_relaxed);
+    }
+
+    std::size_t overflow() { return _overflow.load(std::memory_order_relaxed); }
+    std::size_t high_water() { return _high_water.load(std::memory_order_relaxed); }
+};
+}
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "symbol_table.h"
+
+namespace MQ2DanNet {
+// a query observed on a peer, as symbols -- what observation_table is keyed by
+struct Observed final {
+    symbol query;
+    symbol name;
+
+    Observed() : query(0), name(0) {}
+    Observed(symbol query, symbol name) : query(query), name(name) {}
+};
+
+// what we're observing on other peers (and ourselves), keyed by (peer, query) with the observation right in the slot,
+// plus the observer group as a second way in since that's all an update carries. Open addressing with linear probing,
+// and erasing shifts the rest of the run back so there are never tombstones to step over. Only the main thread touches
+// this, so a pointer into it is good until the next insert or erase
+template <typename T>
+class observation_table {
+private:
+    struct slot final {
+        Observed key; // name 0 is empty
+        std::string group;
+        T observation;
+
+        slot() : observation() {}
+    };
+
+    std::vector<slot> _slots; // size is always 0 or a power of 2
+    std::size_t _size;
+    std::unordered_map<std::string, Observed> _groups; // observer group, key
+
+    static std::size_t hash(const Observed& key) {
+        uint64_t h = (static_cast<uint64_t>(key.name) << 32 | key.query) * 0x9E3779B97F4A7C15ull;
+        return static_cast<std::size_t>(h >> 32);
+    }
+
+    // _slots.size() if key isn't here
+    std::size_t index(const Observed& key) const {
+        if (_size == 0 || key.name == 0 || key.query == 0)
+            return _slots.size();
+
+        std::size_t mask = _slots.size() - 1;
+        for (std::size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+            const slot& s = _slots[i];
+            if (s.key.name == 0)
+                return _slots.size();
+            if (s.key.name == key.name && s.key.query == key.query)
+                return i;
+        }
+    }
+
+    slot& place(slot&& s) {
+        std::size_t mask = _slots.size() - 1;
+        std::size_t i = hash(s.key) & mask;
+        while (_slots[i].key.name != 0)
+            i = (i + 1) & mask;
+
+        _slots[i] = std::move(s);
+        ++_size;
+        return _slots[i];
+    }
+
+    void grow() {
+        std::vector<slot> old(_slots.empty() ? 16 : 2 * _slots.size());
+        old.swap(_slots);
+        _size = 0;
+        for (auto& s : old) {
+            if (s.key.name != 0)
+                place(std::move(s));
+        }
+    }
+
+    void erase_at(std::size_t hole) {
+        _groups.erase(_slots[hole].group);
+        _slots[hole] = slot();
+        --_size;
+
+        // anything later in the run that could sit at (or before) the hole moves back into it
+        std::size_t mask = _slots.size() - 1;
+        for (std::size_t i = (hole + 1) & mask; _slots[i].key.name != 0; i = (i + 1) & mask) {
+            std::size_t home = hash(_slots[i].key) & mask;
+            if (((i - home) & mask) >= ((i - hole) & mask)) {
+                _slots[hole] = std::move(_slots[i]);
+                _slots[i] = slot();
+                hole = i;
+            }
+        }
+    }
+
+public:
+    observation_table() : _size(0) {}
+
+    // a key keeps its observation if it's observed under the same group again, a new group starts it over
+    void insert(const Observed& key, const std::string& group) {
+        auto group_it = _groups.find(group);
+        if (group_it != _groups.end() && (group_it->second.name != key.name || group_it->second.query != key.query))
+            erase_at(index(group_it->second));
+
+        std::size_t i = index(key);
+        if (i != _slots.size()) {
+            slot& s = _slots[i];
+            if (s.group != group) {
+                _groups.erase(s.group);
+                s.group = group;
+                s.observation = T();
+                _groups[group] = key;
+            }
+            return;
+        }
+
+        if ((_size + 1) * 4 > _slots.size() * 3)
+            grow();
+
+        slot s;
+        s.key = key;
+        s.group = group;
+        place(std::move(s));
+        _groups[group] = key;
+    }
+
+    bool erase(const Observed& key, std::string& group) {
+        std::size_t i = index(key);
+        if (i == _slots.size())
+            return false;
+
+        group = _slots[i].group;
+        erase_at(i);
+        return true;
+    }
+
+    bool erase(const std::string& group, Observed& key) {
+        auto group_it = _groups.find(group);
+        if (group_it == _groups.end())
+            return false;
+
+        key = group_it->second;
+        erase_at(index(key));
+        return true;
+    }
+
+    T* find(const Observed& key) {
+        std::size_t i = index(key);
+        return i != _slots.size() ? &_slots[i].observation : nullptr;
+    }
+
+    T* find(const std::string& group) {
+        auto group_it = _groups.find(group);
+        return group_it != _groups.end() ? find(group_it->second) : nullptr;
+    }
+
+    // f(key, group, observation), don't insert or erase from inside it
+    template <typename F>
+    void foreach(F f) const {
+        for (auto& s : _slots) {
+            if (s.key.name != 0)
+                f(s.key, s.group, s.observation);
+        }
+    }
+
+    std::size_t size() const { return _size; }
+};
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "wire.h"
+
+namespace MQ2DanNet {
+// requests waiting on a response. Slots come off a free list and the id handed out is the slot index in the low 16 bits
+// with the slot's generation above it. The generation bumps every time a slot is freed, so a late response for a request
+// that already completed or expired can't land on whatever reuses the slot. Generation 0 is never used, so 0 is never an id
+class pending_table {
+private:
+    static const std::size_t N = 0x10000;
+
+    struct slot {
+        uint16_t generation;
+        bool live;
+        uint64_t deadline;
+        std::function<bool(Reader&&)> callback;
+
+        slot() : generation(1), live(false), deadline(0) {}
+    };
+
+    std::mutex _mutex;
+    std::vector<slot> _slots;
+    std::vector<uint16_t> _free;
+    std::size_t _live;
+    uint64_t _next_deadline; // nothing can expire before this, so the sweep is free until then
+
+    // these expect the lock to be held
+    slot* find(uint32_t id) {
+        std::size_t index = id & 0xFFFF;
+        if (index >= _slots.size())
+            return nullptr;
+
+        slot& s = _slots[index];
+        return s.live && s.generation == (id >> 16) ? &s : nullptr;
+    }
+
+    void release(uint16_t index) {
+        slot& s = _slots[index];
+        s.live = false;
+        s.callback = nullptr;
+        if (++s.generation == 0)
+            s.generation = 1;
+
+        _free.push_back(index);
+        --_live;
+    }
+
+public:
+    pending_table() : _live(0), _next_deadline(0) {}
+
+    // returns 0 if every slot is taken
+    uint32_t insert(std::function<bool(Reader&&)> callback, uint64_t deadline) {
+        uint32_t r = 0;
+        _mutex.lock();
+        if (_free.empty() && _slots.size() < N) {
+            _free.push_back(static_cast<uint16_t>(_slots.size()));
+            _slots.emplace_back();
+        }
+
+        if (!_free.empty()) {
+            uint16_t index = _free.back();
+            _free.pop_back();
+
+            slot& s = _slots[index];
+            s.live = true;
+            s.deadline = deadline;
+            s.callback = std::move(callback);
+            ++_live;
+
+            if (_live == 1 || deadline < _next_deadline)
+                _next_deadline = deadline;
+
+            r = static_cast<uint32_t>(s.generation) << 16 | index;
+        }
+        _mutex.unlock();
+        return r;
+    }
+
+    void erase(uint32_t id) {
+        _mutex.lock();
+        if (find(id))
+            release(static_cast<uint16_t>(id & 0xFFFF));
+        _mutex.unlock();
+    }
+
+    // false if id isn't a live request. The callback runs outside the lock, and the request is done once it returns true
+    bool complete(uint32_t id, Reader&& args) {
+        _mutex.lock();
+        slot* s = find(id);
+        std::function<bool(Reader&&)> f;
+        if (s)
+            f = s->callback;
+        _mutex.unlock();
+
+        if (!s)
+            return false;
+
+        if (!f || f(std::move(args)))
+            erase(id);
+
+        return true;
+    }
+
+    // drops everything past its deadline, returns how many went
+    std::size_t expire(uint64_t now) {
+        std::size_t r = 0;
+        _mutex.lock();
+        if (_live > 0 && now >= _next_deadline) {
+            _next_deadline = ULLONG_MAX;
+            for (std::size_t index = 0; index < _slots.size(); ++index) {
+                slot& s = _slots[index];
+                if (!s.live)
+                    continue;
+
+                if (s.deadline <= now) {
+                    release(static_cast<uint16_t>(index));
+                    ++r;
+                } else {
+                    _next_deadline = std::min(_next_deadline, s.deadline);
+                }
+            }
+        }
+        _mutex.unlock();
+        return r;
+    }
+
+    std::size_t size() {
+        _mutex.lock();
+        std::size_t r = _live;
+        _mutex.unlock();
+        return r;
+    }
+};
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace MQ2DanNet {
+typedef uint32_t symbol; // an interned name (see symbol_table), 0 is never handed out
+
+// every peer name, group name and observed query we've run into, stored once. Ids are handed out in order and never
+// reused, so a name never moves and an id is good for the life of the node. Names are interned as given, so lowercase
+// (and qualify) them first
+class symbol_table {
+private:
+    std::mutex _mutex;
+    std::deque<std::string> _names; // id - 1, name
+    std::unordered_map<std::string, symbol> _ids;
+
+public:
+    symbol intern(const std::string& name) {
+        _mutex.lock();
+        auto id_it = _ids.find(name);
+        symbol r;
+        if (id_it != _ids.end()) {
+            r = id_it->second;
+        } else {
+            _names.push_back(name);
+            r = static_cast<symbol>(_names.size());
+            _ids.emplace(name, r);
+        }
+        _mutex.unlock();
+        return r;
+    }
+
+    // 0 if name was never interned, so a lookup for something we don't know doesn't add it
+    symbol find(const std::string& name) {
+        _mutex.lock();
+        auto id_it = _ids.find(name);
+        symbol r = id_it != _ids.end() ? id_it->second : 0;
+        _mutex.unlock();
+        return r;
+    }
+
+    const std::string& name(symbol id) {
+        static const std::string none;
+        _mutex.lock();
+        const std::string& r = id > 0 && id <= _names.size() ? _names[id - 1] : none;
+        _mutex.unlock();
+        return r;
+    }
+};
+}
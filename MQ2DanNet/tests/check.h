@@ -0,0 +1,43 @@
+#pragma once
+
+// what the standalone tests share: a failure count, CHECK macros that report and keep going, and the one thing
+// archive.h expects windows.h to have provided
+#include <algorithm>
+#include <cstdio>
+#include <stdexcept>
+
+using std::min;
+
+static int failures = 0;
+
+#define CHECK(_Cond)                                                                \
+    do {                                                                            \
+        if (!(_Cond)) {                                                             \
+            std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #_Cond);   \
+            ++failures;                                                             \
+        }                                                                           \
+    } while (0)
+
+// the expression has to throw std::runtime_error, which is how Reader and Archive report malformed data
+#define CHECK_MALFORMED(_Expr)                                                      \
+    do {                                                                            \
+        bool threw = false;                                                         \
+        try {                                                                       \
+            _Expr;                                                                  \
+        } catch (std::runtime_error&) {                                             \
+            threw = true;                                                           \
+        }                                                                           \
+        if (!threw) {                                                               \
+            std::printf("%s:%d: %s didn't throw\n", __FILE__, __LINE__, #_Expr);    \
+            ++failures;                                                             \
+        }                                                                           \
+    } while (0)
+
+static int report(const char* test) {
+    if (failures)
+        std::printf("%s: %d failures\n", test, failures);
+    else
+        std::printf("%s: ok\n", test);
+
+    return failures ? 1 : 0;
+}
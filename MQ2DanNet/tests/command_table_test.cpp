@@ -0,0 +1,80 @@
+// standalone tests for the command table -- see ReadMe.txt for how to build and run them
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "check.h"
+#include "../command_table.h"
+
+using namespace MQ2DanNet;
+
+static const std::string from = "server_sender";
+static const std::string group = "server_group";
+
+static void commands() {
+    command_table commands;
+    int calls = 0;
+    uint32_t seen = 0;
+
+    auto counting = [&calls, &seen](Reader&& args) -> bool {
+        ++calls;
+        args >> seen;
+        return false;
+    };
+
+    Buffer buffer;
+    Archive<Buffer> send(buffer);
+    send << static_cast<uint32_t>(99);
+
+    CHECK(commands.insert(5, "Echo", counting));
+    CHECK(commands.contains(5));
+    CHECK(!commands.contains(6));
+    CHECK(commands.name(5) == "Echo");
+    CHECK(commands.name(6) == "6");
+
+    commands.dispatch(5, Reader(buffer, from, group));
+    CHECK(calls == 1 && seen == 99);
+
+    // same low bits, so these probe past each other
+    CHECK(commands.insert(5 + 64, "Execute", counting));
+    CHECK(commands.insert(5 + 128, "Query", counting));
+    CHECK(commands.name(5 + 128) == "Query");
+    commands.dispatch(5 + 128, Reader(buffer, from, group));
+    CHECK(calls == 2);
+
+    // an id that's already somebody else's is a hash collision, re-registering the same name is fine
+    CHECK(!commands.insert(5, "Observe", counting));
+    CHECK(commands.insert(5, "Echo", counting));
+
+    // unregistering drops the callback but the slot keeps its id, so later probes still get past it
+    commands.erase(5 + 64);
+    commands.dispatch(5 + 64, Reader(buffer, from, group));
+    CHECK(calls == 2);
+    CHECK(commands.name(5 + 128) == "Query");
+
+    // a callback that returns true is dropped after it runs
+    int once = 0;
+    CHECK(commands.insert(7, "Once", [&once](Reader&&) -> bool { return ++once > 0; }));
+    commands.dispatch(7, Reader(buffer, from, group));
+    commands.dispatch(7, Reader(buffer, from, group));
+    CHECK(once == 1);
+
+    // a callback can register another command from inside dispatch
+    CHECK(commands.insert(8, "Register", [&commands, &counting](Reader&&) -> bool { return !commands.insert(9, "Registered", counting); }));
+    commands.dispatch(8, Reader(buffer, from, group));
+    CHECK(commands.contains(9));
+
+    // full
+    command_table full;
+    for (uint32_t id = 0; id < 64; ++id)
+        CHECK(full.insert(id * 1000 + 1, "command" + std::to_string(id), counting));
+    CHECK(!full.insert(64 * 1000 + 1, "one too many", counting));
+    CHECK(full.contains(63 * 1000 + 1));
+}
+
+int main() {
+    commands();
+
+    return report("command_table_test");
+}
@@ -0,0 +1,112 @@
+// producer/consumer throughput of mpsc_queue against the locked_queue it replaced as the command queue.
+//
+// locked_queue is copied from before the change (a mutex around a deque, emplacing at the front and popping from the
+// front, so it's LIFO too). Each producer pushes items shaped like a queued command -- an id, the sender and the group --
+// while one thread pops them, the way the actor feeds the game thread.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "../mpsc_queue.h"
+
+using namespace MQ2DanNet;
+
+template <typename T>
+class locked_queue {
+private:
+    std::mutex _mutex;
+    std::deque<T> _queue;
+
+public:
+    //emplace empty front pop
+    void emplace(T& e) {
+        _mutex.lock();
+        _queue.emplace_front(std::move(e));
+        _mutex.unlock();
+    }
+
+    bool try_pop(T& r) {
+        _mutex.lock();
+        bool popped = !_queue.empty();
+        if (popped) {
+            r = std::move(_queue.front());
+            _queue.pop_front();
+        }
+        _mutex.unlock();
+        return popped;
+    }
+};
+
+struct Command {
+    uint32_t id;
+    std::string from;
+    std::string group;
+};
+
+static bool push(locked_queue<Command>& queue, Command& e) {
+    queue.emplace(e);
+    return true;
+}
+
+template <std::size_t N>
+static bool push(mpsc_queue<Command, N>& queue, Command& e) {
+    return queue.push(e);
+}
+
+// millions of items a second through the queue, start of the first push to the last pop
+template <typename Q>
+static double throughput(unsigned producers, uint32_t per_producer) {
+    Q queue;
+    std::vector<std::thread> threads;
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned p = 0; p < producers; ++p) {
+        threads.emplace_back([&queue, p, per_producer]() {
+            for (uint32_t i = 0; i < per_producer; ++i) {
+                Command e = { i, "server_character" + std::to_string(p), "server_group" };
+                while (!push(queue, e))
+                    std::this_thread::yield();
+            }
+        });
+    }
+
+    uint64_t received = 0, sum = 0;
+    const uint64_t expected = static_cast<uint64_t>(producers) * per_producer;
+    Command e;
+    while (received < expected) {
+        if (queue.try_pop(e)) {
+            sum += e.id + e.from.size();
+            ++received;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (auto& t : threads)
+        t.join();
+
+    CHECK(sum > 0);
+    return expected / seconds / 1e6;
+}
+
+int main() {
+    const uint32_t per_producer = 500000;
+    const unsigned producer_counts[] = { 1, 2, 4 };
+
+    std::printf("%10s %18s %18s\n", "producers", "locked_queue M/s", "mpsc_queue M/s");
+    for (unsigned producers : producer_counts) {
+        double locked = throughput<locked_queue<Command>>(producers, per_producer);
+        double ring = throughput<mpsc_queue<Command, 1024>>(producers, per_producer);
+        std::printf("%10u %18.2f %18.2f\n", producers, locked, ring);
+    }
+
+    return report("mpsc_queue_bench");
+}
@@ -0,0 +1,171 @@
+// standalone tests for mpsc_queue -- no MQ2 or zyre needed, see ReadMe.txt for how to build and run them
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "../mpsc_queue.h"
+
+using namespace MQ2DanNet;
+
+// filling the ring exactly works, one more is refused and counted, and everything comes back out in order
+static void full_ring() {
+    mpsc_queue<int, 8> queue;
+
+    for (int i = 0; i < 8; ++i)
+        CHECK(queue.push(i));
+
+    int extra = 8;
+    CHECK(!queue.push(extra));
+    CHECK(queue.overflow() == 1);
+    CHECK(queue.size() == 8);
+    CHECK(queue.high_water() == 8);
+
+    int value = -1;
+    for (int i = 0; i < 8; ++i) {
+        CHECK(queue.try_pop(value));
+        CHECK(value == i);
+    }
+
+    CHECK(!queue.try_pop(value));
+    CHECK(queue.size() == 0);
+
+    // room again after draining
+    CHECK(queue.push(extra));
+    CHECK(queue.try_pop(value) && value == 8);
+}
+
+// keeping the ring partly full while the positions go around it many times
+static void wraparound() {
+    mpsc_queue<std::string, 4> queue;
+    int pushed = 0, popped = 0;
+
+    for (int round = 0; round < 1000; ++round) {
+        for (int i = 0; i < 3; ++i) {
+            std::string e = std::to_string(pushed);
+            if (queue.push(e))
+                ++pushed;
+            else
+                CHECK(!e.empty()); // a refused push leaves the element alone
+        }
+
+        std::string r;
+        for (int i = 0; i < 2 && queue.try_pop(r); ++i)
+            CHECK(r == std::to_string(popped++));
+    }
+
+    std::string r;
+    while (queue.try_pop(r))
+        CHECK(r == std::to_string(popped++));
+
+    CHECK(pushed == popped);
+    CHECK(pushed > 1000);
+    CHECK(queue.overflow() > 0);
+    CHECK(queue.high_water() == 4);
+}
+
+// several producers hammering a small ring while one thread consumes. Each producer's items have to come out exactly once
+// and in the order it pushed them, which catches both losses and duplicates
+static void producers() {
+    const unsigned producer_count = 4;
+    const uint32_t per_producer = 200000;
+
+    mpsc_queue<uint64_t, 64> queue;
+    std::vector<std::thread> threads;
+    std::vector<uint64_t> refused(producer_count, 0);
+
+    for (unsigned p = 0; p < producer_count; ++p) {
+        threads.emplace_back([&queue, &refused, p, per_producer]() {
+            for (uint32_t i = 0; i < per_producer; ++i) {
+                uint64_t e = (static_cast<uint64_t>(p) << 32) | i;
+                while (!queue.push(e)) {
+                    ++refused[p];
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    std::vector<uint32_t> next(producer_count, 0);
+    uint64_t received = 0, out_of_order = 0;
+    const uint64_t expected = static_cast<uint64_t>(producer_count) * per_producer;
+
+    while (received < expected) {
+        uint64_t e;
+        if (!queue.try_pop(e)) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        unsigned p = static_cast<unsigned>(e >> 32);
+        uint32_t i = static_cast<uint32_t>(e);
+        if (p >= producer_count || i != next[p])
+            ++out_of_order;
+        else
+            ++next[p];
+
+        ++received;
+    }
+
+    for (auto& t : threads)
+        t.join();
+
+    uint64_t e;
+    CHECK(!queue.try_pop(e)); // nothing extra left behind
+    CHECK(out_of_order == 0);
+    for (unsigned p = 0; p < producer_count; ++p)
+        CHECK(next[p] == per_producer);
+
+    uint64_t total_refused = 0;
+    for (auto r : refused)
+        total_refused += r;
+
+    CHECK(queue.overflow() == total_refused);
+    CHECK(queue.high_water() <= 64);
+
+    std::printf("producers: %llu items from %u threads through a 64 cell ring, %llu pushes refused while full\n",
+        static_cast<unsigned long long>(received), producer_count, static_cast<unsigned long long>(total_refused));
+}
+
+// a consumer that keeps the ring close to empty, so pops land right behind each publish. The depth a push records has
+// to stay within the ring no matter how far the consumer has got by the time it's recorded
+static void drained() {
+    mpsc_queue<uint32_t, 1024> queue;
+    std::vector<std::thread> threads;
+    const uint32_t per_producer = 250000;
+
+    for (unsigned p = 0; p < 2; ++p) {
+        threads.emplace_back([&queue, per_producer]() {
+            for (uint32_t i = 0; i < per_producer; ++i) {
+                uint32_t e = i;
+                while (!queue.push(e))
+                    std::this_thread::yield();
+            }
+        });
+    }
+
+    uint32_t received = 0, e;
+    while (received < 2 * per_producer) {
+        if (queue.try_pop(e))
+            ++received;
+    }
+
+    for (auto& t : threads)
+        t.join();
+
+    CHECK(queue.high_water() >= 1);
+    CHECK(queue.high_water() <= 1024);
+    CHECK(queue.size() == 0);
+}
+
+int main() {
+    full_ring();
+    wraparound();
+    producers();
+    drained();
+
+    return report("mpsc_queue_test");
+}
@@ -0,0 +1,141 @@
+// standalone tests for the observation table -- see ReadMe.txt for how to build and run them
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <string>
+#include <utility>
+
+#include "check.h"
+#include "../observation_table.h"
+
+using namespace MQ2DanNet;
+
+static std::string group_of(const Observed& key) {
+    return "group_" + std::to_string(key.name) + "_" + std::to_string(key.query);
+}
+
+// keys that all hash near each other, erased from the front, middle and back of their run, against a std::map
+static void observations_backward_shift() {
+    observation_table<int> table;
+    std::map<std::pair<symbol, symbol>, int> expected;
+
+    for (symbol name = 1; name <= 11; ++name) {
+        Observed key(1, name);
+        table.insert(key, group_of(key));
+        *table.find(key) = static_cast<int>(name);
+        expected[std::make_pair(name, symbol(1))] = static_cast<int>(name);
+    }
+
+    const symbol order[] = { 1, 6, 11, 2, 10, 5, 3, 9, 4, 8, 7 };
+    for (symbol name : order) {
+        Observed key(1, name);
+        std::string erased_group;
+        CHECK(table.erase(key, erased_group));
+        CHECK(erased_group == group_of(key));
+        expected.erase(std::make_pair(name, symbol(1)));
+
+        // everything else is still reachable after the shift, and nothing erased is
+        for (symbol other = 1; other <= 11; ++other) {
+            Observed other_key(1, other);
+            int* found = table.find(other_key);
+            bool present = expected.count(std::make_pair(other, symbol(1))) != 0;
+            CHECK((found != nullptr) == present);
+            if (found && present)
+                CHECK(*found == static_cast<int>(other));
+            CHECK((table.find(group_of(other_key)) != nullptr) == present);
+        }
+
+        CHECK(table.size() == expected.size());
+    }
+}
+
+static void observations_random() {
+    observation_table<int> table;
+    std::map<std::pair<symbol, symbol>, int> expected;
+    std::mt19937 rng(2024);
+
+    for (int step = 0; step < 200000; ++step) {
+        Observed key(1 + rng() % 8, 1 + rng() % 64);
+        auto model = std::make_pair(key.name, key.query);
+
+        switch (rng() % 4) {
+        case 0:
+        case 1: {
+            bool fresh = expected.count(model) == 0;
+            table.insert(key, group_of(key));
+            int* found = table.find(key);
+            CHECK(found != nullptr);
+            if (found) {
+                if (fresh)
+                    CHECK(*found == 0);
+                *found = step;
+            }
+            expected[model] = step;
+            break;
+        }
+        case 2: {
+            std::string erased_group;
+            CHECK(table.erase(key, erased_group) == (expected.erase(model) != 0));
+            break;
+        }
+        default: {
+            Observed erased_key;
+            bool present = expected.count(model) != 0;
+            CHECK(table.erase(group_of(key), erased_key) == present);
+            if (present)
+                CHECK(erased_key.name == key.name && erased_key.query == key.query);
+            expected.erase(model);
+            break;
+        }
+        }
+
+        if (step % 1000 == 0) {
+            CHECK(table.size() == expected.size());
+            std::size_t seen = 0;
+            table.foreach([&expected, &seen](const Observed& key, const std::string& group, const int& value) {
+                auto it = expected.find(std::make_pair(key.name, key.query));
+                CHECK(it != expected.end() && it->second == value && group == group_of(key));
+                ++seen;
+            });
+            CHECK(seen == expected.size());
+        }
+    }
+}
+
+// an observation is kept if it's observed again under its own group and starts over under a new one, and a group
+// only ever points at one key
+static void observations_groups() {
+    observation_table<int> table;
+    Observed key(1, 1);
+    Observed other(2, 1);
+
+    table.insert(key, "group_a");
+    *table.find(key) = 10;
+    table.insert(key, "group_a");
+    CHECK(*table.find(key) == 10);
+
+    table.insert(key, "group_b");
+    CHECK(*table.find(key) == 0);
+    CHECK(table.find("group_a") == nullptr);
+    CHECK(table.find("group_b") == table.find(key));
+
+    // moving a group to another key drops the key that had it
+    table.insert(other, "group_b");
+    CHECK(table.find(key) == nullptr);
+    CHECK(table.find("group_b") == table.find(other));
+    CHECK(table.size() == 1);
+
+    // unknown symbols never match
+    CHECK(table.find(Observed(0, 1)) == nullptr);
+    CHECK(table.find(Observed(1, 0)) == nullptr);
+}
+
+int main() {
+    observations_backward_shift();
+    observations_random();
+    observations_groups();
+
+    return report("observation_table_test");
+}
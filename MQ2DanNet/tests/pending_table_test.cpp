@@ -0,0 +1,89 @@
+// standalone tests for the pending table -- see ReadMe.txt for how to build and run them
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+#include "check.h"
+#include "../pending_table.h"
+
+using namespace MQ2DanNet;
+
+static const std::string from = "server_sender";
+static const std::string group = "server_group";
+
+static void pending() {
+    pending_table requests;
+    Buffer buffer;
+    int answered = 0;
+
+    auto answer = [&answered](Reader&&) -> bool {
+        ++answered;
+        return true;
+    };
+
+    uint32_t first = requests.insert(answer, 1000);
+    CHECK(first != 0);
+    CHECK(requests.size() == 1);
+
+    CHECK(requests.complete(first, Reader(buffer, from, group)));
+    CHECK(answered == 1);
+    CHECK(requests.size() == 0);
+    CHECK(!requests.complete(first, Reader(buffer, from, group))); // already done
+
+    // the slot is reused with a new generation, so the stale id can't reach the new request
+    uint32_t second = requests.insert(answer, 1000);
+    CHECK(second != 0 && second != first);
+    CHECK((second & 0xFFFF) == (first & 0xFFFF));
+    CHECK(!requests.complete(first, Reader(buffer, from, group)));
+    CHECK(answered == 1);
+    CHECK(requests.complete(second, Reader(buffer, from, group)));
+    CHECK(answered == 2);
+
+    // a callback that returns false is waiting on more answers
+    int partial = 0;
+    uint32_t streaming = requests.insert([&partial](Reader&&) -> bool { return ++partial == 3; }, 1000);
+    for (int i = 0; i < 4; ++i)
+        requests.complete(streaming, Reader(buffer, from, group));
+    CHECK(partial == 3);
+    CHECK(requests.size() == 0);
+
+    CHECK(!requests.complete(0, Reader(buffer, from, group)));
+    CHECK(!requests.complete(0x12345678, Reader(buffer, from, group)));
+
+    // expiring only drops what's past its deadline
+    uint32_t early = requests.insert(answer, 100);
+    uint32_t late = requests.insert(answer, 300);
+    requests.insert(answer, 200);
+    CHECK(requests.expire(50) == 0);
+    CHECK(requests.expire(200) == 2);
+    CHECK(requests.size() == 1);
+    CHECK(!requests.complete(early, Reader(buffer, from, group)));
+    CHECK(requests.complete(late, Reader(buffer, from, group)));
+    CHECK(requests.expire(1000) == 0);
+
+    // erase drops it without running it
+    int erased = 0;
+    uint32_t dropped = requests.insert([&erased](Reader&&) -> bool { return ++erased > 0; }, 1000);
+    requests.erase(dropped);
+    CHECK(!requests.complete(dropped, Reader(buffer, from, group)));
+    CHECK(erased == 0);
+
+    // every slot taken
+    pending_table full;
+    for (std::size_t i = 0; i < 0x10000; ++i) {
+        if (full.insert(answer, 1000) == 0) {
+            CHECK(false);
+            break;
+        }
+    }
+    CHECK(full.insert(answer, 1000) == 0);
+    CHECK(full.expire(1000) == 0x10000);
+    CHECK(full.insert(answer, 1000) != 0);
+}
+
+int main() {
+    pending();
+
+    return report("pending_table_test");
+}
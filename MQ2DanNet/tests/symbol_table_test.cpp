@@ -0,0 +1,41 @@
+// standalone tests for the symbol table -- see ReadMe.txt for how to build and run them
+
+#include <cstdio>
+#include <string>
+
+#include "check.h"
+#include "../symbol_table.h"
+
+using namespace MQ2DanNet;
+
+static void symbols() {
+    symbol_table symbols;
+
+    CHECK(symbols.find("server_a") == 0);
+    CHECK(symbols.find("server_a") == 0); // looking doesn't add it
+
+    symbol a = symbols.intern("server_a");
+    symbol b = symbols.intern("server_b");
+    CHECK(a == 1 && b == 2); // in order, and 0 is never handed out
+    CHECK(symbols.intern("server_a") == a);
+    CHECK(symbols.find("server_b") == b);
+    CHECK(symbols.intern("Server_A") != a); // as given, so callers fold case first
+
+    CHECK(symbols.name(a) == "server_a");
+    CHECK(symbols.name(b) == "server_b");
+    CHECK(symbols.name(0).empty());
+    CHECK(symbols.name(100).empty());
+
+    // names don't move as the table grows
+    const std::string* first = &symbols.name(a);
+    for (int i = 0; i < 10000; ++i)
+        symbols.intern("peer_" + std::to_string(i));
+    CHECK(&symbols.name(a) == first);
+    CHECK(symbols.name(symbols.find("peer_9999")) == "peer_9999");
+}
+
+int main() {
+    symbols();
+
+    return report("symbol_table_test");
+}
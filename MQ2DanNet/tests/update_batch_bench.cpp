@@ -0,0 +1,235 @@
+// what a pulse of changed observer values costs, one shout<Update> per observer group against one UpdateBatch per
+// subscriber. Subscribers that get the same batch share it: it's encoded once and goes through the actor pipe once, and the
+// actor whispers a copy to each of them.
+//
+// Message counts are exact: a shout is one message into the actor pipe and then one zyre message to every peer in the
+// group, a shared batch is one into the pipe and one zyre message per peer. CPU is split by who pays it. The sender packs
+// (and for batches, regroups), with one copy of the body per zyre message as a stand-in for zyre framing each message per
+// peer. Decoding happens on the receivers, so that's given per receiver rather than summed over the raid. Values are
+// strings here since Value lives with the MQ2 types.
+//
+// What zyre and zmq spend per message (the pipe hop, framing, the send itself) isn't here beyond that copy.
+
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "../wire.h"
+
+using namespace MQ2DanNet;
+
+static const std::string self = "server_observed";
+
+struct Scenario {
+    const char* description;
+    std::map<std::string, std::set<std::string>> subscribers; // observer group, subscriber names
+    std::map<std::string, std::string> changed;               // observer group, value
+
+    explicit Scenario(const char* description) : description(description) {}
+};
+
+// one body through the pipe, and everybody it goes out to
+struct Sent {
+    std::string group; // what a shout carries, empty for a batch
+    Buffer body;
+    std::vector<std::string> peers;
+};
+
+struct Cost {
+    std::size_t pipe_messages;
+    std::size_t wire_messages;
+    std::size_t wire_bytes;
+    std::size_t values_applied;
+};
+
+static std::size_t sink = 0;
+
+// one copy of the body per message zyre sends
+static void frame(const Sent& sent) {
+    for (std::size_t i = 0; i < sent.peers.size(); ++i) {
+        std::string copy(sent.body.data(), sent.body.size());
+        sink += copy.size();
+    }
+}
+
+static std::vector<Sent> shout_each(const Scenario& scenario) {
+    std::vector<Sent> pulse;
+    for (auto& update : scenario.changed) {
+        Sent sent;
+        sent.group = update.first;
+        Archive<Buffer> send(sent.body);
+        send << update.second;
+
+        auto& subscribers = scenario.subscribers.at(update.first);
+        sent.peers.assign(subscribers.begin(), subscribers.end());
+        frame(sent);
+        pulse.push_back(std::move(sent));
+    }
+
+    return pulse;
+}
+
+static std::vector<Sent> whisper_batches(const Scenario& scenario) {
+    // the same regrouping publish does
+    typedef std::vector<const std::pair<const std::string, std::string>*> Results;
+    std::map<std::string, Results> wanted; // peer, the changed values it observes
+    for (auto& update : scenario.changed) {
+        for (auto& peer : scenario.subscribers.at(update.first))
+            wanted[peer].push_back(&update);
+    }
+
+    std::map<Results, std::vector<std::string>> destinations; // values, peers
+    for (auto& peer : wanted)
+        destinations[peer.second].push_back(peer.first);
+
+    std::vector<Sent> pulse;
+    for (auto& destination : destinations) {
+        std::map<std::string, std::string> batch; // observer group, value
+        for (auto result : destination.first)
+            batch.emplace(result->first, result->second);
+
+        Sent sent;
+        Archive<Buffer> send(sent.body);
+        send << batch;
+        sent.peers = std::move(destination.second);
+        frame(sent);
+        pulse.push_back(std::move(sent));
+    }
+
+    return pulse;
+}
+
+// everything one peer decodes out of a pulse
+static std::size_t receive(const std::vector<Sent>& pulse, const std::string& peer) {
+    std::size_t applied = 0;
+    for (auto& sent : pulse) {
+        if (std::find(sent.peers.begin(), sent.peers.end(), peer) == sent.peers.end())
+            continue;
+
+        Reader args(sent.body, self, sent.group);
+        if (!sent.group.empty()) {
+            std::string value;
+            args >> value;
+            sink += value.size();
+            ++applied;
+        } else {
+            std::map<std::string, std::string> results;
+            args >> results;
+            for (auto& result : results) {
+                sink += result.first.size() + result.second.size();
+                ++applied;
+            }
+        }
+    }
+
+    return applied;
+}
+
+static Cost cost(const std::vector<Sent>& pulse, const std::set<std::string>& receivers) {
+    Cost cost = {};
+    for (auto& sent : pulse) {
+        ++cost.pipe_messages;
+        cost.wire_messages += sent.peers.size();
+        cost.wire_bytes += sent.peers.size() * (sent.body.size() + sent.group.size());
+    }
+
+    for (auto& peer : receivers)
+        cost.values_applied += receive(pulse, peer);
+
+    return cost;
+}
+
+static std::string observer_group(int key) {
+    return self + "_" + std::to_string(key);
+}
+
+static std::string peer(int i) {
+    return "server_character" + std::to_string(i);
+}
+
+static void changed(Scenario& scenario, int every) {
+    int key = 0;
+    for (auto& group : scenario.subscribers) {
+        if (key++ % every == 0)
+            scenario.changed[group.first] = std::to_string(key * 7919 % 100000);
+    }
+}
+
+template <typename F>
+static double time_us(int pulses, F f) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < pulses; ++i)
+        f();
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / pulses;
+}
+
+int main() {
+    std::vector<Scenario> scenarios;
+
+    // one box driving another, watching 30 things on it
+    Scenario driver("30 observers, 1 subscriber");
+    for (int key = 1; key <= 30; ++key)
+        driver.subscribers[observer_group(key)].insert(peer(0));
+    changed(driver, 1);
+    scenarios.push_back(driver);
+
+    // a group of 6 each watching 5 of its own
+    Scenario group("30 observers, 6 subscribers x 5");
+    for (int key = 1; key <= 30; ++key)
+        group.subscribers[observer_group(key)].insert(peer((key - 1) / 5));
+    changed(group, 1);
+    scenarios.push_back(group);
+
+    // the tank, with 10 things everybody in a 54 box raid watches
+    Scenario raid("10 observers, 54 subscribers");
+    for (int key = 1; key <= 10; ++key) {
+        for (int i = 0; i < 54; ++i)
+            raid.subscribers[observer_group(key)].insert(peer(i));
+    }
+    changed(raid, 1);
+    scenarios.push_back(raid);
+
+    // same raid, but only some of them changed this pulse
+    Scenario quiet = raid;
+    quiet.description = "10 observers, 54 subs, 3 changed";
+    quiet.changed.clear();
+    changed(quiet, 4);
+    scenarios.push_back(quiet);
+
+    const int pulses = 2000;
+
+    std::printf("%-34s %6s %6s %6s %6s %7s %7s %7s %7s %7s %7s\n", "per pulse", "pipe", "pipe", "wire", "wire", "bytes",
+        "bytes", "send us", "send us", "recv us", "recv us");
+    std::printf("%-34s %6s %6s %6s %6s %7s %7s %7s %7s %7s %7s\n", "", "shout", "batch", "shout", "batch", "shout", "batch",
+        "shout", "batch", "shout", "batch");
+
+    for (auto& scenario : scenarios) {
+        std::set<std::string> receivers;
+        for (auto& group : scenario.subscribers)
+            receivers.insert(group.second.begin(), group.second.end());
+
+        std::vector<Sent> shouted = shout_each(scenario);
+        std::vector<Sent> batched = whisper_batches(scenario);
+        Cost shout = cost(shouted, receivers);
+        Cost batch = cost(batched, receivers);
+        CHECK(shout.values_applied == batch.values_applied);
+
+        double shout_send = time_us(pulses, [&scenario]() { shout_each(scenario); });
+        double batch_send = time_us(pulses, [&scenario]() { whisper_batches(scenario); });
+        // every receiver decodes its own share, so one of them is what a box in the raid pays
+        const std::string& one = *receivers.begin();
+        double shout_receive = time_us(pulses, [&shouted, &one]() { receive(shouted, one); });
+        double batch_receive = time_us(pulses, [&batched, &one]() { receive(batched, one); });
+
+        std::printf("%-34s %6zu %6zu %6zu %6zu %7zu %7zu %7.1f %7.1f %7.2f %7.2f\n", scenario.description,
+            shout.pipe_messages, batch.pipe_messages, shout.wire_messages, batch.wire_messages, shout.wire_bytes,
+            batch.wire_bytes, shout_send, batch_send, shout_receive, batch_receive);
+    }
+
+    std::printf("checksum %zu\n", sink);
+    return report("update_batch_bench");
+}
@@ -0,0 +1,197 @@
+// whisper routing cost as the peer count grows -- the old zyre_peers() walk against the actor-local name index.
+//
+// zyre can't run here, so the zyre actor is modeled as a thread that owns the peer table and answers one request at a
+// time, the way zyre_peers() and zyre_peer_header_value() each make a synchronous round trip over an inproc pipe. The
+// old resolve is 1 + (peers up to the match) of those round trips plus the copies zyre hands back. The new one is what
+// Node::peer_uuid does on the actor's own thread: qualify the name, find its symbol (under the symbol table's mutex),
+// then look the symbol up in _connected_peers and copy the uuid out. Both sides start from the short name a command is
+// usually given. The absolute numbers depend on the box, the ratio is the point.
+
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "../symbol_table.h"
+
+using namespace MQ2DanNet;
+
+#define MAX_STRING 2048
+typedef char CHAR;
+static const char* EQADDR_SERVERNAME = "Server";
+
+// Node::qualify
+static void qualify(const std::string& name, CHAR (&buffer)[MAX_STRING]) {
+    std::size_t length = 0;
+
+    if (std::string::npos == name.find_last_of("_")) {
+        for (const char* c = EQADDR_SERVERNAME; *c && length < MAX_STRING - 2; ++c)
+            buffer[length++] = static_cast<char>(::tolower(static_cast<unsigned char>(*c)));
+        buffer[length++] = '_';
+    }
+
+    for (std::size_t i = 0; i < name.size() && length < MAX_STRING - 1; ++i)
+        buffer[length++] = static_cast<char>(::tolower(static_cast<unsigned char>(name[i])));
+
+    buffer[length] = '\0';
+}
+
+class zyre_model {
+private:
+    enum class request { none, peers, header, stop };
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    request _request;
+    bool _answered;
+    std::string _uuid;
+    std::vector<std::string> _peers_reply;
+    std::string _header_reply;
+
+    std::map<std::string, std::string> _names; // uuid, name header
+    std::thread _thread;
+
+    void serve() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        for (;;) {
+            _cv.wait(lock, [this]() { return _request != request::none && !_answered; });
+
+            if (_request == request::stop)
+                return;
+
+            if (_request == request::peers) {
+                _peers_reply.clear();
+                for (auto& peer : _names)
+                    _peers_reply.push_back(peer.first);
+            } else {
+                auto it = _names.find(_uuid);
+                _header_reply = it != _names.end() ? it->second : std::string();
+            }
+
+            _answered = true;
+            _cv.notify_all();
+        }
+    }
+
+    void round_trip(request r) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _request = r;
+        _answered = false;
+        _cv.notify_all();
+        _cv.wait(lock, [this]() { return _answered; });
+        _request = request::none;
+    }
+
+public:
+    explicit zyre_model(const std::map<std::string, std::string>& names) : _request(request::none), _answered(false), _names(names) {
+        _thread = std::thread([this]() { serve(); });
+    }
+
+    ~zyre_model() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _request = request::stop;
+            _answered = false;
+        }
+        _cv.notify_all();
+        _thread.join();
+    }
+
+    std::vector<std::string> peers() {
+        round_trip(request::peers);
+        return _peers_reply;
+    }
+
+    std::string peer_header_value(const std::string& uuid) {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _uuid = uuid;
+        }
+        round_trip(request::header);
+        return _header_reply;
+    }
+};
+
+// what peer_uuid() did before the index
+static std::string walk_peers(zyre_model& zyre, const std::string& name) {
+    CHAR full_name[MAX_STRING];
+    qualify(name, full_name);
+    for (auto& uuid : zyre.peers()) {
+        if (zyre.peer_header_value(uuid) == full_name)
+            return uuid;
+    }
+
+    return std::string();
+}
+
+// Node::peer_uuid
+static std::string peer_uuid(symbol_table& symbols, const std::unordered_map<symbol, std::string>& connected_peers, const std::string& name) {
+    CHAR full_name[MAX_STRING];
+    qualify(name, full_name);
+    auto uuid_it = connected_peers.find(symbols.find(full_name));
+    if (uuid_it != connected_peers.end())
+        return uuid_it->second;
+
+    return std::string();
+}
+
+int main() {
+    const int peer_counts[] = { 1, 6, 12, 24, 54, 108 };
+    const int lookups = 2000;
+
+    std::printf("%6s %16s %16s %10s\n", "peers", "walk (us/call)", "index (us/call)", "ratio");
+
+    for (int count : peer_counts) {
+        std::map<std::string, std::string> names;
+        symbol_table symbols;
+        std::unordered_map<symbol, std::string> connected_peers;
+        std::vector<std::string> short_names;
+        std::mt19937 rng(count);
+
+        for (int i = 0; i < count; ++i) {
+            char uuid[33];
+            std::snprintf(uuid, sizeof(uuid), "%08X%08X%08X%08X", static_cast<unsigned>(rng()), static_cast<unsigned>(rng()), static_cast<unsigned>(rng()), static_cast<unsigned>(rng()));
+            std::string full_name = "server_character" + std::to_string(i);
+            names[uuid] = full_name;
+            connected_peers[symbols.intern(full_name)] = uuid;
+            short_names.push_back("Character" + std::to_string(i));
+        }
+
+        // the rest of what a node has interned -- groups, other peers' groups, observed queries
+        for (int i = 0; i < 200; ++i)
+            symbols.intern("group" + std::to_string(i));
+
+        std::vector<std::string> targets;
+        for (int i = 0; i < lookups; ++i)
+            targets.push_back(short_names[rng() % short_names.size()]);
+
+        zyre_model zyre(names);
+        std::size_t found = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        for (auto& target : targets)
+            found += !walk_peers(zyre, target).empty();
+        auto walk = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / lookups;
+
+        start = std::chrono::steady_clock::now();
+        for (auto& target : targets)
+            found += !peer_uuid(symbols, connected_peers, target).empty();
+        auto indexed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / lookups;
+
+        if (found != 2 * targets.size()) {
+            std::printf("lookup mismatch at %d peers\n", count);
+            return 1;
+        }
+
+        std::printf("%6d %16.2f %16.3f %9.0fx\n", count, walk, indexed, walk / indexed);
+    }
+
+    return 0;
+}
@@ -0,0 +1,130 @@
+// pack and dispatch cost of a command body, the stringstream API commands used to have against Buffer and Reader.
+//
+// before: pack into a stringstream through Archive, copy it out with str() to make the frame, then on the way in build a
+// new stringstream with the sender and group in front of the frame and read everything back through Archive.
+// after: pack into a Buffer (whose storage goes to zmq as is), then read the frame in place through a Reader, with the
+// sender and group borrowed rather than serialized.
+
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "../wire.h"
+
+using namespace MQ2DanNet;
+
+static const std::string from = "server_sender";
+static const std::string group = "server_group";
+
+// keeps the optimizer from dropping the work
+static std::size_t sink = 0;
+
+template <typename F>
+static double time_ns(F f, int iterations) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+        f();
+
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+}
+
+template <typename T>
+static std::string pack_stream(const T& body) {
+    std::stringstream send_stream;
+    Archive<std::stringstream> send(send_stream);
+    send << body;
+
+    return send_stream.str(); // what went into the zframe
+}
+
+template <typename T>
+static T dispatch_stream(const std::string& frame) {
+    std::stringstream args;
+    Archive<std::stringstream> args_ar(args);
+    args_ar << from << group;
+    args.write(frame.data(), frame.size());
+
+    Archive<std::stringstream> received(args);
+    std::string received_from, received_group;
+    T body;
+    received >> received_from >> received_group >> body;
+    sink += received_from.size() + received_group.size();
+
+    return body;
+}
+
+template <typename T>
+static Buffer pack_buffer(const T& body) {
+    Buffer send_buffer;
+    Archive<Buffer> send(send_buffer);
+    send << body;
+
+    return send_buffer;
+}
+
+template <typename T>
+static T dispatch_reader(const char* data, std::size_t size) {
+    Reader args(data, size, from, group);
+    T body;
+    args >> body;
+    sink += args.from().size() + args.group().size();
+
+    return body;
+}
+
+int main() {
+    const int iterations = 200000;
+
+    std::string command = "/multiline ; /target id 1234 ; /cast 3 ; /timed 20 /dgt all ready";
+    std::map<std::string, std::string> batch;
+    for (int i = 0; i < 10; ++i)
+        batch["server_character_" + std::to_string(i)] = std::to_string(i * 12345);
+
+    // both sides have to agree on what they read before the timings mean anything
+    {
+        std::string frame = pack_stream(command);
+        Buffer buffer = pack_buffer(command);
+        CHECK(frame == std::string(buffer.data(), buffer.size()));
+        CHECK(dispatch_stream<std::string>(frame) == command);
+        CHECK(dispatch_reader<View>(buffer.data(), buffer.size()).str() == command);
+
+        std::string batch_frame = pack_stream(batch);
+        Buffer batch_buffer = pack_buffer(batch);
+        CHECK(batch_frame == std::string(batch_buffer.data(), batch_buffer.size()));
+        CHECK((dispatch_stream<std::map<std::string, std::string>>(batch_frame) == batch));
+        CHECK((dispatch_reader<std::map<std::string, std::string>>(batch_buffer.data(), batch_buffer.size()) == batch));
+
+        if (failures)
+            return report("wire_bench");
+    }
+
+    std::printf("%-28s %14s %14s\n", "ns/op", "stringstream", "Buffer/Reader");
+
+    double before = time_ns([&]() { sink += pack_stream(command).size(); }, iterations);
+    double after = time_ns([&]() { sink += pack_buffer(command).size(); }, iterations);
+    std::printf("%-28s %14.1f %14.1f\n", "pack Execute", before, after);
+
+    std::string frame = pack_stream(command);
+    before = time_ns([&]() { sink += dispatch_stream<std::string>(frame).size(); }, iterations);
+    after = time_ns([&]() { sink += dispatch_reader<View>(frame.data(), frame.size()).size; }, iterations);
+    std::printf("%-28s %14.1f %14.1f\n", "dispatch Execute (View)", before, after);
+
+    after = time_ns([&]() { sink += dispatch_reader<std::string>(frame.data(), frame.size()).size(); }, iterations);
+    std::printf("%-28s %14s %14.1f\n", "dispatch Execute (string)", "", after);
+
+    before = time_ns([&]() { sink += pack_stream(batch).size(); }, iterations);
+    after = time_ns([&]() { sink += pack_buffer(batch).size(); }, iterations);
+    std::printf("%-28s %14.1f %14.1f\n", "pack 10 entry batch", before, after);
+
+    std::string batch_frame = pack_stream(batch);
+    before = time_ns([&]() { sink += dispatch_stream<std::map<std::string, std::string>>(batch_frame).size(); }, iterations);
+    after = time_ns([&]() { sink += dispatch_reader<std::map<std::string, std::string>>(batch_frame.data(), batch_frame.size()).size(); }, iterations);
+    std::printf("%-28s %14.1f %14.1f\n", "dispatch 10 entry batch", before, after);
+
+    std::printf("checksum %zu\n", sink);
+    return 0;
+}
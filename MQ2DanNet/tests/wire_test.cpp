@@ -0,0 +1,168 @@
+// standalone tests for Buffer and Reader -- see ReadMe.txt for how to build and run them
+
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <stdexcept>
+#include <string>
+
+#include "check.h"
+#include "../wire.h"
+
+using namespace MQ2DanNet;
+
+static const std::string from = "server_sender";
+static const std::string group = "server_group";
+
+// big endian, the way Archive writes a length prefix
+static void put_length(Buffer& buffer, uint32_t len) {
+    const char bytes[] = { static_cast<char>(len >> 24), static_cast<char>(len >> 16), static_cast<char>(len >> 8), static_cast<char>(len) };
+    buffer.write(bytes, sizeof(bytes));
+}
+
+// whatever Archive writes, Reader reads back the same
+static void round_trip() {
+    Buffer buffer;
+    Archive<Buffer> send(buffer);
+
+    std::map<std::string, std::string> batch = { { "group_1", "100" }, { "group_2", "" }, { "group_3", std::string(5000, 'x') } };
+    send << static_cast<uint32_t>(0xDEADBEEF) << std::string("hello") << std::string("as a view") << static_cast<unsigned char>(7)
+         << 1.5f << true << std::make_pair(std::string("key"), 42) << batch;
+
+    Reader args(buffer, from, group);
+    uint32_t key = 0;
+    std::string text;
+    View view;
+    unsigned char tag = 0;
+    float real = 0;
+    bool flag = false;
+    std::pair<std::string, int> pair;
+    std::map<std::string, std::string> received;
+
+    args >> key >> text >> view >> tag >> real >> flag >> pair >> received;
+
+    CHECK(key == 0xDEADBEEF);
+    CHECK(text == "hello");
+    CHECK(view.str() == "as a view");
+    CHECK(view.data >= buffer.data() && view.data + view.size <= buffer.data() + buffer.size()); // no copy
+    CHECK(tag == 7);
+    CHECK(real == 1.5f);
+    CHECK(flag);
+    CHECK(pair.first == "key" && pair.second == 42);
+    CHECK(received == batch);
+    CHECK(args.remaining() == 0);
+    CHECK(&args.from() == &from && &args.group() == &group);
+}
+
+// fewer bytes than the field needs, including an empty frame
+static void short_frame() {
+    Reader empty(nullptr, 0, from, group);
+    uint32_t key;
+    CHECK_MALFORMED(empty >> key);
+
+    const char three[] = { 1, 2, 3 };
+    Reader args(three, sizeof(three), from, group);
+    CHECK_MALFORMED(args >> key);
+
+    unsigned char tag = 0;
+    Reader one(three, 1, from, group);
+    one >> tag;
+    CHECK(tag == 1);
+    CHECK_MALFORMED(one >> tag);
+}
+
+// the length prefix itself is cut off
+static void truncated_length() {
+    const char two[] = { 0, 0 };
+    std::string text;
+    View view;
+
+    Reader args(two, sizeof(two), from, group);
+    CHECK_MALFORMED(args >> text);
+
+    Reader view_args(two, sizeof(two), from, group);
+    CHECK_MALFORMED(view_args >> view);
+}
+
+// a length prefix that promises more than the frame has, right up to one that would wrap a careless bounds check
+static void oversized_length() {
+    const uint32_t lengths[] = { 6, 100, 0x7FFFFFFF, 0xFFFFFFFF };
+    for (uint32_t len : lengths) {
+        Buffer buffer;
+        put_length(buffer, len);
+        buffer.write("hello", 5);
+
+        std::string text;
+        View view;
+        Reader args(buffer, from, group);
+        CHECK_MALFORMED(args >> text);
+
+        Reader view_args(buffer, from, group);
+        CHECK_MALFORMED(view_args >> view);
+    }
+
+    // a map claiming more entries than there are
+    Buffer buffer;
+    put_length(buffer, 3);
+    put_length(buffer, 1);
+    buffer.write("a", 1);
+    put_length(buffer, 1);
+    buffer.write("b", 1);
+
+    std::map<std::string, std::string> batch;
+    Reader args(buffer, from, group);
+    CHECK_MALFORMED(args >> batch);
+}
+
+// bytes past the schema aren't an error, they're just left unread
+static void trailing_bytes() {
+    Buffer buffer;
+    Archive<Buffer> send(buffer);
+    send << std::string("request") << static_cast<uint32_t>(12345);
+
+    std::string request;
+    Reader args(buffer, from, group);
+    args >> request;
+    CHECK(request == "request");
+    CHECK(args.remaining() == sizeof(uint32_t));
+
+    uint32_t extra = 0;
+    args >> extra;
+    CHECK(extra == 12345);
+    CHECK(args.remaining() == 0);
+}
+
+// the storage is handed over as is, and growing keeps what was written
+static void buffer_growth() {
+    Buffer buffer;
+    std::string expected;
+    for (int i = 0; i < 1000; ++i) {
+        std::string chunk = std::to_string(i);
+        buffer.write(chunk.data(), chunk.size());
+        expected += chunk;
+    }
+
+    CHECK(buffer.size() == expected.size());
+    CHECK(std::string(buffer.data(), buffer.size()) == expected);
+
+    Buffer moved(std::move(buffer));
+    CHECK(buffer.size() == 0 && buffer.data() == nullptr);
+    CHECK(moved.size() == expected.size());
+
+    std::size_t size = moved.size();
+    char* data = moved.release();
+    CHECK(moved.size() == 0 && moved.data() == nullptr);
+    CHECK(std::string(data, size) == expected);
+    free(data);
+}
+
+int main() {
+    round_trip();
+    short_frame();
+    truncated_length();
+    oversized_length();
+    trailing_bytes();
+    buffer_growth();
+
+    return report("wire_test");
+}
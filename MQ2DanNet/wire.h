@@ -0,0 +1,182 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#ifdef LOCAL_BUILD
+#include <archive.h>
+#else
+#include "..\archive\archive.h"
+#endif
+
+namespace MQ2DanNet {
+// growable output buffer that commands are serialized into (it's the stream type for the outgoing Archive). The storage
+// is handed to zmq as is when the message goes to the actor, so there's no copy between serializing and the pipe
+class Buffer final {
+private:
+    char* _data;
+    std::size_t _size;
+    std::size_t _capacity;
+
+public:
+    Buffer() : _data(nullptr), _size(0), _capacity(0) {}
+    ~Buffer() { free(_data); }
+
+    Buffer(Buffer&& other) noexcept : _data(other._data), _size(other._size), _capacity(other._capacity) {
+        other._data = nullptr;
+        other._size = 0;
+        other._capacity = 0;
+    }
+
+    Buffer& operator=(Buffer&& rhs) noexcept {
+        if (this != &rhs) {
+            free(_data);
+            _data = rhs._data;
+            _size = rhs._size;
+            _capacity = rhs._capacity;
+            rhs._data = nullptr;
+            rhs._size = 0;
+            rhs._capacity = 0;
+        }
+
+        return *this;
+    }
+
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
+
+    void write(const char* data, std::size_t size) {
+        if (_size + size > _capacity)
+            reserve(std::max<std::size_t>(_size + size, std::max<std::size_t>(256, 2 * _capacity)));
+
+        memcpy(_data + _size, data, size);
+        _size += size;
+    }
+
+    void reserve(std::size_t capacity) {
+        if (capacity <= _capacity)
+            return;
+
+        char* data = reinterpret_cast<char*>(realloc(_data, capacity));
+        if (!data)
+            throw std::bad_alloc();
+
+        _data = data;
+        _capacity = capacity;
+    }
+
+    // Archive checks the stream after every write, and this can't fail short of running out of memory
+    bool operator!() const { return false; }
+
+    const char* data() const { return _data; }
+    std::size_t size() const { return _size; }
+
+    // the caller owns the storage after this and has to free() it
+    char* release() {
+        char* data = _data;
+        _data = nullptr;
+        _size = 0;
+        _capacity = 0;
+        return data;
+    }
+};
+
+// a string inside a received frame, only good for as long as the frame is
+struct View final {
+    const char* data;
+    std::size_t size;
+
+    View() : data(nullptr), size(0) {}
+    View(const char* data, std::size_t size) : data(data), size(size) {}
+
+    std::string str() const { return std::string(data, size); }
+    bool empty() const { return size == 0; }
+};
+
+// read-only counterpart to Buffer over memory somebody else owns (usually the frame zyre gave us), reading the same big
+// endian format Archive writes. Everything is bounds checked and throws std::runtime_error on malformed data just like
+// Archive, and strings can be read as a View to skip the copy. The sender and group aren't part of the body, they're
+// borrowed from whoever made the reader.
+class Reader final {
+private:
+    const char* _data;
+    std::size_t _size;
+    std::size_t _pos;
+    const std::string* _from;
+    const std::string* _group;
+
+    const char* take(std::size_t size) {
+        if (size > _size - _pos)
+            throw std::runtime_error("malformed data");
+
+        const char* r = _data + _pos;
+        _pos += size;
+        return r;
+    }
+
+public:
+    Reader(const char* data, std::size_t size, const std::string& from, const std::string& group) : _data(data), _size(size), _pos(0), _from(&from), _group(&group) {}
+    Reader(const Buffer& buffer, const std::string& from, const std::string& group) : Reader(buffer.data(), buffer.size(), from, group) {}
+
+    const std::string& from() const { return *_from; }
+    const std::string& group() const { return *_group; }
+
+    // whatever is left after the fields read so far. Extra bytes aren't an error, a newer sender may have added fields
+    std::size_t remaining() const { return _size - _pos; }
+
+    template <class T>
+    typename std::enable_if<std::is_arithmetic<T>::value, Reader&>::type operator&(T& v) {
+        memcpy(&v, take(sizeof(T)), sizeof(T));
+        v = EndianSwapper::SwapByte<T, sizeof(T)>::Swap(v);
+        return *this;
+    }
+
+    Reader& operator&(View& v) {
+        uint32_t len;
+        *this & len;
+        v = View(take(len), len);
+        return *this;
+    }
+
+    Reader& operator&(std::string& v) {
+        uint32_t len;
+        *this & len;
+        v.assign(take(len), len);
+        return *this;
+    }
+
+    template <class T1, class T2>
+    Reader& operator&(std::pair<T1, T2>& v) {
+        return *this & v.first & v.second;
+    }
+
+    template <class T1, class T2>
+    Reader& operator&(std::map<T1, T2>& v) {
+        uint32_t len;
+        *this & len;
+        v.clear();
+        for (uint32_t i = 0; i < len; ++i) {
+            std::pair<T1, T2> value;
+            *this & value;
+            v.insert(v.end(), std::move(value));
+        }
+        return *this;
+    }
+
+    template <class T>
+    typename std::enable_if<std::is_class<T>::value, Reader&>::type operator&(T& v) {
+        v.Serialize(*this);
+        return *this;
+    }
+
+    template <class T>
+    Reader& operator>>(T& v) { return *this & v; }
+};
+}